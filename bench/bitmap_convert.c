@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "flipdot.h"
+
+
+// Compares flipdot_bitmap_to_frame()/flipdot_frame_to_bitmap() with the
+// previous bit-by-bit conversion and checks that both give equal results.
+
+#define ITERATIONS 200000
+
+#define SETBIT(b,i) ((((uint8_t *)(b))[(i) >> 3]) |= (1 << ((i) & 7)))
+#define ISBITSET(b,i) (((((uint8_t *)(b))[(i) >> 3]) & (1 << ((i) & 7))) != 0)
+
+
+static void
+bitmap_to_frame_bitwise(const uint8_t *bitmap, flipdot_frame_t *frame)
+{
+	memset(frame, 0x00, sizeof(*frame));
+
+	for (uint_fast16_t i = 0; i < DISP_PIXEL_COUNT; i++) {
+		if (ISBITSET(bitmap, i)) {
+			SETBIT(frame, i + ((i / MODULE_COLS) * COL_GAP));
+		}
+	}
+}
+
+static void
+frame_to_bitmap_bitwise(const uint8_t *frame, flipdot_bitmap_t *bitmap)
+{
+	memset(bitmap, 0x00, sizeof(*bitmap));
+
+	for (uint_fast16_t i = 0; i < DISP_PIXEL_COUNT; i++) {
+		if (ISBITSET(frame, i + ((i / MODULE_COLS) * COL_GAP))) {
+			SETBIT(bitmap, i);
+		}
+	}
+}
+
+static uint64_t
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+report(const char *name, uint64_t ns)
+{
+	printf("%-24s %8.1f ns/frame\n", name, (double)ns / ITERATIONS);
+}
+
+
+int
+main(void)
+{
+	static flipdot_bitmap_t bitmaps[16];
+	static flipdot_frame_t frames[16];
+	flipdot_bitmap_t bitmap, bitmap_ref;
+	flipdot_frame_t frame, frame_ref;
+	uint64_t start;
+	uint32_t sink = 0;
+
+	srand(1);
+
+	for (unsigned i = 0; i < 16; i++) {
+		for (unsigned j = 0; j < sizeof(bitmaps[i]); j++) {
+			bitmaps[i][j] = rand();
+		}
+
+		// bits past DISP_PIXEL_COUNT are not part of the bitmap
+		if (DISP_PIXEL_COUNT % 8) {
+			bitmaps[i][DISP_BYTE_COUNT - 1] &= (1 << (DISP_PIXEL_COUNT % 8)) - 1;
+		}
+
+		flipdot_bitmap_to_frame(bitmaps[i], &frame);
+		bitmap_to_frame_bitwise(bitmaps[i], &frame_ref);
+
+		if (memcmp(frame, frame_ref, sizeof(frame)) != 0) {
+			fprintf(stderr, "bitmap_to_frame mismatch\n");
+			return 1;
+		}
+
+		flipdot_frame_to_bitmap(frame, &bitmap);
+		frame_to_bitmap_bitwise(frame, &bitmap_ref);
+
+		if (memcmp(bitmap, bitmap_ref, sizeof(bitmap)) != 0 ||
+			memcmp(bitmap, bitmaps[i], sizeof(bitmap)) != 0) {
+			fprintf(stderr, "frame_to_bitmap mismatch\n");
+			return 1;
+		}
+
+		memcpy(frames[i], frame, sizeof(frame));
+	}
+
+	printf("%d x %d pixels, %d iterations\n", DISP_COLS, DISP_ROWS, ITERATIONS);
+
+	start = now();
+	for (unsigned i = 0; i < ITERATIONS; i++) {
+		bitmap_to_frame_bitwise(bitmaps[i & 15], &frame);
+		sink += frame[i % sizeof(frame)];
+	}
+	report("bitmap_to_frame bitwise", now() - start);
+
+	start = now();
+	for (unsigned i = 0; i < ITERATIONS; i++) {
+		flipdot_bitmap_to_frame(bitmaps[i & 15], &frame);
+		sink += frame[i % sizeof(frame)];
+	}
+	report("bitmap_to_frame", now() - start);
+
+	start = now();
+	for (unsigned i = 0; i < ITERATIONS; i++) {
+		frame_to_bitmap_bitwise(frames[i & 15], &bitmap);
+		sink += bitmap[i % sizeof(bitmap)];
+	}
+	report("frame_to_bitmap bitwise", now() - start);
+
+	start = now();
+	for (unsigned i = 0; i < ITERATIONS; i++) {
+		flipdot_frame_to_bitmap(frames[i & 15], &bitmap);
+		sink += bitmap[i % sizeof(bitmap)];
+	}
+	report("frame_to_bitmap", now() - start);
+
+	return (sink == 0xFFFFFFFF);
+}
@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// wave_shift() and wave_play() are static, so flipdot.c is compiled in
+// with the NOSLEEP of the archive build and the simulated backend
+#define NOSLEEP
+#define HW_DEFAULT flipdot_hw_sim
+#include "../flipdot.c"
+
+
+// Measures the shift kernel throughput: host time per shift clock on the
+// simulated backend. Full register loads of random rows and columns go
+// through wave_shift() and wave_play() alone and through the per-bit
+// reference kernel they replaced, both clock every bit. The best of
+// ROUNDS rounds is reported. Then random frames are updated through the
+// library.
+
+#define SHIFTS 50000
+#define ROUNDS 5
+#define FRAMES 2000
+
+
+static flipdot_row_reg_t load_rows[16];
+static flipdot_col_reg_t load_cols[16];
+
+
+static uint64_t
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+ref_write(uint32_t clr, uint32_t set)
+{
+	if (clr) {
+		hw->clr_multi(clr);
+	}
+
+	if (set) {
+		hw->set_multi(set);
+	}
+}
+
+// The shift loop before the nibble tables: a ternary and ISBITSET() per
+// bit and register, every clock clears the last clock and data lines
+// and sets the new data lines, with separate clear and set calls.
+static void
+ref_shift(const uint8_t *rows, const uint8_t *cols)
+{
+	uint_fast16_t bit = (REGISTER_ROWS > CHAIN_COLS) ? REGISTER_ROWS : CHAIN_COLS;
+	uint32_t last = 0;
+
+	while (bit--) {
+		uint32_t data = 0;
+		uint32_t clk = 0;
+
+		for (uint_fast8_t chain = 0; chain < CHAIN_COUNT; chain++) {
+			if (bit < REGISTER_ROWS) {
+				clk |= _BV(ROW_CLK);
+				data |= ISBITSET(rows, bit) ? _BV(chain_row_data[chain]) : 0;
+			}
+
+			if (bit < CHAIN_COLS) {
+				clk |= _BV(COL_CLK);
+				data |= ISBITSET(cols, (chain * CHAIN_COLS) + bit) ? _BV(chain_col_data[chain]) : 0;
+			}
+		}
+
+		ref_write(last, data);
+		ref_write(0, clk);
+
+		last = clk | data;
+	}
+
+	if (last) {
+		ref_write(last, 0);
+	}
+}
+
+// compile and play a full shift of both registers
+static void
+lib_shift(const uint8_t *rows, const uint8_t *cols)
+{
+	struct wave_op *end = wave_shift(wave, rows, REGISTER_ROWS, cols, CHAIN_COLS);
+
+	wave_play(wave, end - wave);
+}
+
+// shift with either kernel, then strobe and pulse the same way
+static void
+load(int reference, const uint8_t *rows, const uint8_t *cols, uint8_t oe)
+{
+	uint8_t pin = oe ? OE1 : OE0;
+
+	if (reference) {
+		ref_shift(rows, cols);
+	} else {
+		lib_shift(rows, cols);
+	}
+
+	ref_write(0, _BV(STROBE));
+	ref_write(_BV(STROBE), 0);
+
+	ref_write(0, _BV(pin));
+	hw->sleep(FLIP_DELAY * 1000);
+	ref_write(_BV(pin), 0);
+	hw->sleep(OE_DELAY * 1000);
+}
+
+// Shifts: full loads of both registers, nothing else is timed
+static void
+run_shifts(int reference, struct flipdot_sim_stats *stats)
+{
+	uint64_t start, elapsed, best = UINT64_MAX;
+	uint64_t clocks;
+
+	flipdot_init();
+	flipdot_sim_reset();
+
+	for (unsigned round = 0; round < ROUNDS; round++) {
+		start = now();
+		for (unsigned i = 0; i < SHIFTS; i++) {
+			if (reference) {
+				ref_shift(load_rows[i & 15], load_cols[i & 15]);
+			} else {
+				lib_shift(load_rows[i & 15], load_cols[i & 15]);
+			}
+		}
+		elapsed = now() - start;
+
+		if (elapsed < best) {
+			best = elapsed;
+		}
+	}
+
+	flipdot_sim_get_stats(stats);
+	clocks = (stats->row_clocks + stats->col_clocks) / ROUNDS;
+
+	printf("%-10s %10.1f %10.1f %10.1f %10.2f %10.2f %10.2f\n", reference ? "reference" : "library",
+		(double)stats->writes / ROUNDS / SHIFTS, (double)stats->edges / ROUNDS / SHIFTS,
+		(double)clocks / SHIFTS, (double)best / clocks, clocks * 1e3 / best,
+		(double)best * ROUNDS / stats->writes);
+}
+
+// Loads: shift, strobe and pulse every pattern with both polarities
+static void
+run_loads(int reference, flipdot_frame_t *dots)
+{
+	flipdot_init();
+	flipdot_sim_reset();
+
+	for (unsigned i = 0; i < 32; i++) {
+		load(reference, load_rows[i & 15], load_cols[i & 15], i >> 4);
+	}
+
+	flipdot_sim_get_frame(dots);
+}
+
+
+int
+main(void)
+{
+	static flipdot_bitmap_t bitmaps[16];
+	flipdot_frame_t ref_dots, lib_dots;
+	struct flipdot_sim_stats ref_stats, lib_stats, stats;
+	uint64_t start, elapsed;
+
+	srand(1);
+
+	for (unsigned i = 0; i < 16; i++) {
+		for (unsigned j = 0; j < sizeof(bitmaps[i]); j++) {
+			bitmaps[i][j] = rand();
+		}
+
+		for (unsigned j = 0; j < sizeof(load_rows[i]); j++) {
+			load_rows[i][j] = rand();
+		}
+
+		for (unsigned j = 0; j < sizeof(load_cols[i]); j++) {
+			load_cols[i][j] = rand();
+		}
+	}
+
+	flipdot_set_hw(&flipdot_hw_sim);
+
+	if (!flipdot_init()) {
+		return 1;
+	}
+
+	printf("%d x %d pixels, %d chain(s)\n\n", DISP_COLS, DISP_ROWS, CHAIN_COUNT);
+	printf("%-10s %10s %10s %10s %10s %10s %10s\n", "shifts", "writes", "edges", "clocks", "ns/clock", "Mclocks/s", "ns/write");
+
+	run_shifts(1, &ref_stats);
+	run_shifts(0, &lib_stats);
+
+	if (ref_stats.row_clocks != lib_stats.row_clocks || ref_stats.col_clocks != lib_stats.col_clocks) {
+		printf("MISMATCH: the kernels shifted different clock counts\n");
+		return 1;
+	}
+
+	run_loads(1, &ref_dots);
+	run_loads(0, &lib_dots);
+
+	if (memcmp(ref_dots, lib_dots, sizeof(ref_dots)) != 0) {
+		printf("MISMATCH: the kernels left different dots\n");
+		return 1;
+	}
+
+	printf("\n%-10s %10s %10s %10s %10s %10s %10s\n", "frames", "writes", "edges", "clocks", "writes/s", "edges/s", "host us");
+
+	flipdot_init();
+	flipdot_sim_reset();
+
+	start = now();
+	for (unsigned i = 0; i < FRAMES; i++) {
+		flipdot_update_bitmap(bitmaps[i & 15]);
+	}
+	elapsed = now() - start;
+
+	flipdot_sim_get_stats(&stats);
+	flipdot_shutdown();
+
+	printf("%-10s %10.1f %10.1f %10.1f %10.3g %10.3g %10.2f\n", "library",
+		(double)stats.writes / FRAMES, (double)stats.edges / FRAMES,
+		(double)(stats.row_clocks + stats.col_clocks) / FRAMES,
+		stats.writes * 1e9 / elapsed, stats.edges * 1e9 / elapsed,
+		elapsed / 1e3 / FRAMES);
+
+	return 0;
+}
@@ -0,0 +1,366 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "flipdot.h"
+#include "flipdot_anim.h"
+#include "flipdot_hw.h"
+
+
+// Replays standard workloads through flipdot_update_frame() on the
+// simulated backend. Modeled time is the virtual time of the simulator:
+// SIM_WRITE_DELAY per GPIO write plus the flip and OE delays. CPU time
+// covers the update call only and includes simulating the GPIO writes.
+// usage: bench/workloads [file.fda]
+// Captured video frames are replayed from an animation file, a
+// synthetic clip of moving discs is used without one.
+
+#define BMP_SETBIT(b,x,y) ((b)[(((y)*DISP_COLS)+(x))>>3] |= (1<<((((y)*DISP_COLS)+(x))&7)))
+#define BMP_CLEARBIT(b,x,y) ((b)[(((y)*DISP_COLS)+(x))>>3] &= ~(1<<((((y)*DISP_COLS)+(x))&7)))
+
+#define MIN(a,b) (((a) < (b)) ? (a) : (b))
+
+#define RANDOM_FRAMES 1000
+#define VIDEO_FRAMES 500
+#define SPECTRUM_FRAMES 1000
+
+#define TEXT "FLIPDOT 0123456789 THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG"
+
+
+struct workload {
+	const char *name;
+	unsigned frames;
+	void (*next)(unsigned n, flipdot_frame_t *frame);
+};
+
+
+static flipdot_bitmap_t bmp;
+
+static const uint8_t *anim_data;
+static size_t anim_size;
+static const uint8_t *anim_record;
+
+
+static uint64_t
+cpu_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+bmp_clear(void)
+{
+	memset(bmp, 0x00, sizeof(bmp));
+	srandom(1);
+}
+
+
+// fliptest: set the diagonals one by one, then clear them again
+
+#define DIAGONALS (DISP_COLS + DISP_ROWS - 1)
+
+static void
+diagonal_next(unsigned n, flipdot_frame_t *frame)
+{
+	unsigned i = n % DIAGONALS;
+
+	for (int j = MIN(i, DISP_COLS - 1); j >= 0 && (i - j) < DISP_ROWS; j--) {
+		if (n < DIAGONALS) {
+			BMP_SETBIT(bmp, j, i - j);
+		} else {
+			BMP_CLEARBIT(bmp, j, i - j);
+		}
+	}
+
+	flipdot_bitmap_to_frame(bmp, frame);
+}
+
+
+// fliptest: set one random dot and clear another
+
+static void
+random_next(unsigned n, flipdot_frame_t *frame)
+{
+	(void)n;
+
+	BMP_SETBIT(bmp, random() % DISP_COLS, random() % DISP_ROWS);
+	BMP_CLEARBIT(bmp, random() % DISP_COLS, random() % DISP_ROWS);
+
+	flipdot_bitmap_to_frame(bmp, frame);
+}
+
+
+// Text scrolling left by one column per frame, 3x5 font scaled to the display
+
+static const uint8_t font[][5] = {
+	{ 7, 5, 5, 5, 7 }, { 2, 6, 2, 2, 7 }, { 7, 1, 7, 4, 7 }, { 7, 1, 7, 1, 7 },
+	{ 5, 5, 7, 1, 1 }, { 7, 4, 7, 1, 7 }, { 7, 4, 7, 5, 7 }, { 7, 1, 2, 2, 2 },
+	{ 7, 5, 7, 5, 7 }, { 7, 5, 7, 1, 7 },
+	{ 2, 5, 7, 5, 5 }, { 6, 5, 6, 5, 6 }, { 3, 4, 4, 4, 3 }, { 6, 5, 5, 5, 6 },
+	{ 7, 4, 6, 4, 7 }, { 7, 4, 6, 4, 4 }, { 3, 4, 5, 5, 3 }, { 5, 5, 7, 5, 5 },
+	{ 7, 2, 2, 2, 7 }, { 1, 1, 1, 5, 2 }, { 5, 5, 6, 5, 5 }, { 4, 4, 4, 4, 7 },
+	{ 5, 7, 7, 5, 5 }, { 6, 5, 5, 5, 5 }, { 2, 5, 5, 5, 2 }, { 6, 5, 6, 4, 4 },
+	{ 2, 5, 5, 6, 3 }, { 6, 5, 6, 5, 5 }, { 3, 4, 2, 1, 6 }, { 7, 2, 2, 2, 2 },
+	{ 5, 5, 5, 5, 7 }, { 5, 5, 5, 5, 2 }, { 5, 5, 7, 7, 5 }, { 5, 5, 2, 5, 5 },
+	{ 5, 5, 2, 2, 2 }, { 7, 1, 2, 4, 7 }
+};
+
+#define TEXT_SCALE ((DISP_ROWS / 6) ? (DISP_ROWS / 6) : 1)
+#define TEXT_WIDTH ((sizeof(TEXT) - 1) * 4 * TEXT_SCALE)
+
+// text pixel at column x of the whole message, row y of the glyphs
+static int
+text_pixel(unsigned x, unsigned y)
+{
+	char c = TEXT[x / (4 * TEXT_SCALE)];
+	unsigned gx = (x / TEXT_SCALE) % 4;
+	unsigned gy = y / TEXT_SCALE;
+	const uint8_t *glyph;
+
+	if (gx == 3 || gy >= 5) {
+		return 0;
+	}
+
+	if (c >= '0' && c <= '9') {
+		glyph = font[c - '0'];
+	} else if (c >= 'A' && c <= 'Z') {
+		glyph = font[10 + c - 'A'];
+	} else {
+		return 0;
+	}
+
+	return (glyph[gy] >> (2 - gx)) & 1;
+}
+
+static void
+text_next(unsigned n, flipdot_frame_t *frame)
+{
+	unsigned top = (DISP_ROWS - (5 * TEXT_SCALE)) / 2;
+
+	memset(bmp, 0x00, sizeof(bmp));
+
+	// the message enters at the right edge
+	for (unsigned x = 0; x < DISP_COLS; x++) {
+		unsigned tx = n + x;
+
+		if (tx < DISP_COLS || tx - DISP_COLS >= TEXT_WIDTH) {
+			continue;
+		}
+
+		for (unsigned y = 0; y < 5 * TEXT_SCALE; y++) {
+			if (text_pixel(tx - DISP_COLS, y)) {
+				BMP_SETBIT(bmp, x, top + y);
+			}
+		}
+	}
+
+	flipdot_bitmap_to_frame(bmp, frame);
+}
+
+
+// Video: frames of an animation file or discs moving across the display
+
+static void
+video_next(unsigned n, flipdot_frame_t *frame)
+{
+	static const int speed[3][2] = { { 3, 2 }, { -2, 3 }, { 1, -4 } };
+	int r = (DISP_ROWS / 4) + 1;
+
+	if (anim_data) {
+		uint16_t duration;
+
+		if (n == 0) {
+			anim_record = anim_data + FLIPDOT_ANIM_HEADER_SIZE;
+			memset(frame, 0x00, sizeof(*frame));
+		}
+
+		anim_record = flipdot_anim_next(anim_record, frame, &duration);
+		return;
+	}
+
+	memset(bmp, 0x00, sizeof(bmp));
+
+	for (unsigned d = 0; d < 3; d++) {
+		// bounce between the edges, 1/4 pixel per step
+		int px = (((speed[d][0] * (int)n) + (d * 37)) % (8 * DISP_COLS) + (8 * DISP_COLS)) % (8 * DISP_COLS);
+		int py = (((speed[d][1] * (int)n) + (d * 23)) % (8 * DISP_ROWS) + (8 * DISP_ROWS)) % (8 * DISP_ROWS);
+		int cx = abs(px - (4 * DISP_COLS)) / 4;
+		int cy = abs(py - (4 * DISP_ROWS)) / 4;
+
+		for (int y = cy - r; y <= cy + r; y++) {
+			for (int x = cx - r; x <= cx + r; x++) {
+				if (x < 0 || y < 0 || x >= DISP_COLS || y >= DISP_ROWS ||
+					((x - cx) * (x - cx)) + ((y - cy) * (y - cy)) > r * r) {
+					continue;
+				}
+
+				// overlapping discs cancel out
+				bmp[((y * DISP_COLS) + x) >> 3] ^= 1 << (((y * DISP_COLS) + x) & 7);
+			}
+		}
+	}
+
+	flipdot_bitmap_to_frame(bmp, frame);
+}
+
+
+// Spectrum analyzer: one bar per column, heights change like flipspect's
+
+static void
+spectrum_next(unsigned n, flipdot_frame_t *frame)
+{
+	static uint8_t height[DISP_COLS];
+
+	if (n == 0) {
+		memset(height, 0, sizeof(height));
+	}
+
+	memset(bmp, 0x00, sizeof(bmp));
+
+	for (unsigned x = 0; x < DISP_COLS; x++) {
+		// attack fast, decay by a dot, quieter towards high frequencies
+		unsigned peak = random() % (DISP_ROWS + 1 - ((x * DISP_ROWS) / (2 * DISP_COLS)));
+
+		if (peak > height[x]) {
+			height[x] = peak;
+		} else if (height[x] > 0) {
+			height[x]--;
+		}
+
+		for (unsigned y = 0; y < height[x]; y++) {
+			BMP_SETBIT(bmp, x, DISP_ROWS - 1 - y);
+		}
+	}
+
+	flipdot_bitmap_to_frame(bmp, frame);
+}
+
+
+static const struct workload workloads[] = {
+	{ "diagonal", 2 * DIAGONALS, diagonal_next },
+	{ "random", RANDOM_FRAMES, random_next },
+	{ "text", DISP_COLS + TEXT_WIDTH, text_next },
+	{ "video", VIDEO_FRAMES, video_next },
+	{ "spectrum", SPECTRUM_FRAMES, spectrum_next },
+};
+
+
+static int
+run(const struct workload *w)
+{
+	static flipdot_frame_t frame, prev;
+	struct flipdot_sim_stats before, after;
+	flipdot_frame_t dots;
+	uint64_t cpu = 0, pixels = 0;
+	unsigned frames = w->frames;
+	double f;
+
+	if (anim_data && w->next == video_next) {
+		frames = flipdot_anim_check(anim_data, anim_size);
+	}
+
+	flipdot_sim_reset();
+	if (!flipdot_init()) {
+		return 0;
+	}
+
+	bmp_clear();
+	memset(prev, 0x00, sizeof(prev));
+	flipdot_sim_get_stats(&before);
+
+	for (unsigned n = 0; n < frames; n++) {
+		uint64_t start;
+
+		w->next(n, &frame);
+
+		for (unsigned i = 0; i < FRAME_BYTE_COUNT; i++) {
+			pixels += __builtin_popcount(frame[i] ^ prev[i]);
+		}
+		memcpy(prev, frame, sizeof(prev));
+
+		start = cpu_now();
+		flipdot_update_frame(frame);
+		cpu += cpu_now() - start;
+	}
+
+	flipdot_sim_get_stats(&after);
+	flipdot_sim_get_frame(&dots);
+	flipdot_shutdown();
+
+	f = frames ? frames : 1;
+
+	printf("%-10s %6u %8.1f %8.1f %9.1f %9.1f %10.3f %9.1f %9.1f %s\n",
+		w->name, frames,
+		pixels / f,
+		((after.pulses_0 + after.pulses_1) - (before.pulses_0 + before.pulses_1)) / f,
+		((after.row_clocks + after.col_clocks) - (before.row_clocks + before.col_clocks)) / f,
+		(after.edges - before.edges) / f,
+		(after.time - before.time) / f / 1e6,
+		(after.time > before.time) ? (f * 1e9) / (after.time - before.time) : 0.0,
+		cpu / f / 1e3,
+		memcmp(dots, frame, sizeof(dots)) ? "MISMATCH" : "ok");
+
+	return 1;
+}
+
+static int
+load_anim(const char *path)
+{
+	static uint8_t *data;
+	FILE *f = fopen(path, "rb");
+	long size;
+
+	if (!f || fseek(f, 0, SEEK_END) || (size = ftell(f)) < 0 || fseek(f, 0, SEEK_SET)) {
+		perror(path);
+		return 0;
+	}
+
+	if (!(data = malloc(size ? size : 1)) || fread(data, 1, size, f) != (size_t)size) {
+		perror(path);
+		fclose(f);
+		return 0;
+	}
+	fclose(f);
+
+	if (!flipdot_anim_check(data, size)) {
+		fprintf(stderr, "%s: not an animation for this display geometry\n", path);
+		return 0;
+	}
+
+	anim_data = data;
+	anim_size = size;
+	return 1;
+}
+
+
+int
+main(int argc, char **argv)
+{
+	if (argc > 2) {
+		fprintf(stderr, "usage: %s [file.fda]\n", argv[0]);
+		return 1;
+	}
+
+	if (argc == 2 && !load_anim(argv[1])) {
+		return 1;
+	}
+
+	flipdot_set_hw(&flipdot_hw_sim);
+
+	printf("%d x %d pixels, %d chain(s), FLIP_DELAY %d us, OE_DELAY %d us, %d ns per GPIO write\n\n",
+		DISP_COLS, DISP_ROWS, CHAIN_COUNT, FLIP_DELAY, OE_DELAY, SIM_WRITE_DELAY);
+	printf("%-10s %6s %8s %8s %9s %9s %10s %9s %9s\n",
+		"workload", "frames", "dots/f", "pulses/f", "clocks/f", "edges/f", "model ms/f", "model fps", "cpu us/f");
+
+	for (unsigned i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+		if (!run(&workloads[i])) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -2,29 +2,146 @@
 #include <stdint.h>
 #include <string.h>
 #include <signal.h>
-#include <bcm2835.h>
+#include <unistd.h>
 #include "flipdot.h"
 
 
+// Reads frames from stdin and sends them to the display, loops until EOF.
+// usage: flip_pipe [-r | -p]
+//   ASCII bitmaps ending with an empty line (default)
+//   -r  raw flipdot_bitmap_t frames of DISP_BYTE_COUNT bytes
+//   -p  netpbm P4 frames, black pixels set their dots, cropped or padded to the display
+
 #define BMP_SETBIT(b,x,y) ((uint8_t *)(b))[(((y)*DISP_COLS)+(x))>>3]|=(1<<((((y)*DISP_COLS)+(x))&7));
 #define BMP_CLEARBIT(b,x,y) (((uint8_t *)(b))[(((y)*DISP_COLS)+(x))>>3]&=(1<<((((y)*DISP_COLS)+(x))&7))^0xFF);
 
+// largest P4 row read at once
+#define PBM_ROW_MAX 4096
+
 flipdot_bitmap_t bmp;
 unsigned int x, y;
 
+// input buffer for the binary modes
+static uint8_t in_buf[65536];
+static size_t in_pos, in_len;
 
-int main(void) {
-	int c;
 
-	if (!bcm2835_init())
-		return 1;
+// Fill dst with n bytes, large reads go straight to dst. Returns 0 at EOF.
+static int in_read(void *dst, size_t n) {
+	uint8_t *p = dst;
+	size_t have = in_len - in_pos;
 
-	// shut down GPIOs on exit
-	signal(SIGINT, (__sighandler_t)flipdot_shutdown);
-	signal(SIGTERM, (__sighandler_t)flipdot_shutdown);
+	if (have > n) {
+		have = n;
+	}
 
-	flipdot_init();
-	flipdot_clear_to_0();
+	memcpy(p, in_buf + in_pos, have);
+	in_pos += have;
+	p += have;
+	n -= have;
+
+	while (n > 0) {
+		ssize_t r;
+
+		if (n >= sizeof(in_buf)) {
+			r = read(STDIN_FILENO, p, n);
+			if (r <= 0) {
+				return 0;
+			}
+			p += r;
+			n -= r;
+			continue;
+		}
+
+		if ((r = read(STDIN_FILENO, in_buf, sizeof(in_buf))) <= 0) {
+			return 0;
+		}
+
+		in_len = r;
+		in_pos = (r < (ssize_t)n) ? r : n;
+		memcpy(p, in_buf, in_pos);
+		p += in_pos;
+		n -= in_pos;
+	}
+
+	return 1;
+}
+
+static int in_getc(void) {
+	uint8_t c;
+
+	return in_read(&c, 1) ? c : EOF;
+}
+
+// skip whitespace and comments, read a decimal number
+static int pbm_number(void) {
+	int c, n = 0;
+
+	while ((c = in_getc()) != EOF) {
+		if (c == '#') {
+			while ((c = in_getc()) != EOF && c != '\n');
+		} else if (c < '0' || c > '9') {
+			continue;
+		} else {
+			break;
+		}
+	}
+
+	if (c == EOF) {
+		return -1;
+	}
+
+	do {
+		n = (n * 10) + (c - '0');
+	} while ((c = in_getc()) >= '0' && c <= '9');
+
+	// c is the single whitespace before the raster
+	return n;
+}
+
+static int read_pbm(void) {
+	static uint8_t row[PBM_ROW_MAX];
+	int width, height;
+	size_t row_size;
+
+	if (in_getc() != 'P' || in_getc() != '4') {
+		return 0;
+	}
+
+	if ((width = pbm_number()) <= 0 || (height = pbm_number()) <= 0) {
+		return 0;
+	}
+
+	row_size = (width + 7) / 8;
+	if (row_size > sizeof(row)) {
+		fprintf(stderr, "P4 frame too wide\n");
+		return 0;
+	}
+
+	memset(bmp, 0x00, sizeof(bmp));
+
+	for (int r = 0; r < height; r++) {
+		if (!in_read(row, row_size)) {
+			return 0;
+		}
+
+		if (r >= DISP_ROWS) {
+			continue;
+		}
+
+		// P4 rows are MSB first with 1 for black, a black pixel sets its dot
+		for (int c = 0; c < width && c < DISP_COLS; c++) {
+			if (row[c >> 3] & (0x80 >> (c & 7))) {
+				BMP_SETBIT(bmp, c, r);
+			}
+		}
+	}
+
+	return 1;
+}
+
+static void pipe_ascii(void) {
+	int c;
 
 	memset(bmp, 0x00, sizeof(bmp));
 	x = 0;
@@ -57,6 +174,43 @@ int main(void) {
 			x++;
 		}
 	}
+}
+
+int main(int argc, char **argv) {
+	char mode = 'a';
+
+	if (argc == 2 && (!strcmp(argv[1], "-r") || !strcmp(argv[1], "-p"))) {
+		mode = argv[1][1];
+	} else if (argc != 1) {
+		fprintf(stderr, "usage: %s [-r | -p]\n", argv[0]);
+		return 1;
+	}
+
+	// shut down GPIOs on exit
+	signal(SIGINT, (__sighandler_t)flipdot_shutdown);
+	signal(SIGTERM, (__sighandler_t)flipdot_shutdown);
+
+	if (!flipdot_init())
+		return 1;
+	flipdot_clear_to_0();
+
+	switch (mode) {
+		case 'r':
+			while (in_read(bmp, sizeof(bmp))) {
+				flipdot_update_bitmap(bmp);
+			}
+			break;
+
+		case 'p':
+			while (read_pbm()) {
+				flipdot_update_bitmap(bmp);
+			}
+			break;
+
+		default:
+			pipe_ascii();
+			break;
+	}
 
 	flipdot_shutdown();
 	return(0);
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "flipdot.h"
+#include "flipdot_anim.h"
+
+
+// Converts ASCII bitmaps in the flip_pipe format from stdin into an
+// animation file on stdout. Every frame is shown for duration ms,
+// repeated frames are merged into one record.
+// usage: flipanim_encode <duration> <in.txt >out.fda
+
+#define BMP_SETBIT(b,x,y) ((uint8_t *)(b))[(((y)*DISP_COLS)+(x))>>3]|=(1<<((((y)*DISP_COLS)+(x))&7));
+
+
+static flipdot_bitmap_t bmp;
+static flipdot_frame_t frame, prev, pending;
+static int have_prev, have_pending;
+static unsigned pending_duration;
+
+static void flush(void) {
+	uint8_t record[FLIPDOT_ANIM_RECORD_MAX];
+	size_t len;
+
+	if (!have_pending) {
+		return;
+	}
+
+	len = flipdot_anim_record(record, pending_duration, pending, have_prev ? prev : NULL);
+	fwrite(record, len, 1, stdout);
+
+	memcpy(prev, pending, sizeof(prev));
+	have_prev = 1;
+	have_pending = 0;
+}
+
+static void add(unsigned duration) {
+	flipdot_bitmap_to_frame(bmp, &frame);
+
+	if (have_pending && memcmp(frame, pending, sizeof(frame)) == 0 &&
+		pending_duration + duration <= UINT16_MAX) {
+		pending_duration += duration;
+		return;
+	}
+
+	flush();
+
+	memcpy(pending, frame, sizeof(pending));
+	pending_duration = duration;
+	have_pending = 1;
+}
+
+int main(int argc, char **argv) {
+	uint8_t header[FLIPDOT_ANIM_HEADER_SIZE];
+	unsigned duration, x = 0, y = 0;
+	int c;
+
+	if (argc != 2 || (duration = atoi(argv[1])) == 0 || duration > UINT16_MAX) {
+		fprintf(stderr, "usage: %s <duration> <in.txt >out.fda\n", argv[0]);
+		return 1;
+	}
+
+	fwrite(header, flipdot_anim_header(header), 1, stdout);
+
+	while ((c = getc(stdin)) != EOF) {
+		if (c == '\n') {
+			if ((c = getc(stdin)) == '\n' || c == EOF) {
+				add(duration);
+
+				memset(bmp, 0x00, sizeof(bmp));
+				x = 0;
+				y = 0;
+
+				if (c == EOF) {
+					break;
+				}
+				continue;
+			}
+
+			x = 0;
+			y++;
+		}
+
+		if (x < DISP_COLS && y < DISP_ROWS) {
+			if (c != '0' && c != ' ') {
+				BMP_SETBIT(bmp, x, y);
+			}
+			x++;
+		}
+	}
+
+	flush();
+
+	return ferror(stdout) ? 1 : 0;
+}
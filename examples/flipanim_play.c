@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "flipdot.h"
+#include "flipdot_anim.h"
+
+
+// Plays an animation file made by flipanim_encode, loops times or forever.
+// usage: flipanim_play <file.fda> [loops]
+
+static volatile sig_atomic_t running = 1;
+
+
+static void stop(int sig) {
+	(void)sig;
+	running = 0;
+}
+
+int main(int argc, char **argv) {
+	flipdot_frame_t frame;
+	const uint8_t *data, *end;
+	struct stat st;
+	size_t count;
+	uint64_t next;
+	int loops = 0;
+	int fd;
+
+	if (argc != 2 && argc != 3) {
+		fprintf(stderr, "usage: %s <file.fda> [loops]\n", argv[0]);
+		return 1;
+	}
+
+	if (argc == 3) {
+		loops = atoi(argv[2]);
+	}
+
+	if ((fd = open(argv[1], O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	if ((count = flipdot_anim_check(data, st.st_size)) == 0) {
+		fprintf(stderr, "%s: not an animation for %d x %d pixels\n", argv[1], DISP_COLS, DISP_ROWS);
+		return 1;
+	}
+
+	end = data + st.st_size;
+
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+
+	if (!flipdot_init())
+		return 1;
+	flipdot_clear_to_0();
+
+	next = flipdot_now();
+
+	for (int loop = 0; running && (loops == 0 || loop < loops); loop++) {
+		const uint8_t *record = data + FLIPDOT_ANIM_HEADER_SIZE;
+
+		memset(frame, 0x00, sizeof(frame));
+
+		while (running && record < end) {
+			uint16_t duration;
+
+			record = flipdot_anim_next(record, &frame, &duration);
+
+			flipdot_update_frame_at(frame, next);
+			next += duration * 1000000ULL;
+		}
+	}
+
+	flipdot_shutdown();
+	munmap((void *)data, st.st_size);
+
+	return 0;
+}
@@ -1,12 +1,10 @@
 #include <signal.h>
-#include <bcm2835.h>
 #include "flipdot.h"
 
 int main(void) {
-	if (!bcm2835_init())
+	if (!flipdot_init())
 		return 1;
 
-	flipdot_init();
 	flipdot_clear_to_1();
 	flipdot_shutdown();
 
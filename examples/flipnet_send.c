@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "flipdot.h"
+#include "flipdot_net.h"
+
+
+// Reads packed 1-bit bitmaps of a whole wall from stdin and sends the
+// tiles to flipnetd over multicast. The wall is tiles_h x tiles_v tiles of
+// DISP_COLS x DISP_ROWS pixels, pixel (x, y) is bit y * width + x, LSB first.
+// Tiles are numbered row by row from the top left.
+// Frames are presented delay ms after they were read (default 100), or
+// paced at fps. Clock sync requests of the nodes are answered on port + 1.
+// usage: flipnet_send <group> <port> <tiles_h> <tiles_v> [fps [delay]]
+
+// send a key frame every KEY_INTERVAL frames so nodes can resync
+#define KEY_INTERVAL 25
+
+#define DEFAULT_DELAY 100
+
+#define ISBITSET(b,i) (((((uint8_t *)(b))[(i) >> 3]) & (1 << ((i) & 7))) != 0)
+#define SETBIT(b,i) ((((uint8_t *)(b))[(i) >> 3]) |= (1 << ((i) & 7)))
+
+
+static uint64_t now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+// answer clock sync requests with the sender clock
+static void *clock_server(void *arg) {
+	int sock = *(int *)arg;
+
+	for (;;) {
+		uint8_t packet[FLIPDOT_NET_PACKET_MAX];
+		struct flipdot_net_header header;
+		struct sockaddr_in from;
+		socklen_t fromlen = sizeof(from);
+		ssize_t len;
+		uint64_t t2;
+
+		len = recvfrom(sock, packet, sizeof(packet), 0, (struct sockaddr *)&from, &fromlen);
+		t2 = now();
+
+		if (len <= 0 || !flipdot_net_parse(packet, len, &header) || header.type != FLIPDOT_NET_SYNC_REQUEST) {
+			continue;
+		}
+
+		len = flipdot_net_sync_reply(packet, packet, t2, now());
+		sendto(sock, packet, len, 0, (struct sockaddr *)&from, fromlen);
+	}
+
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	static uint8_t packet[FLIPDOT_NET_PACKET_MAX];
+	struct sockaddr_in addr, clock_addr;
+	struct timespec next;
+	pthread_t clock_thread;
+	uint64_t start, delay = DEFAULT_DELAY * 1000000ULL;
+	unsigned tiles_h, tiles_v, tile_count, width;
+	size_t wall_size;
+	uint8_t *wall;
+	flipdot_frame_t *frames, *prev;
+	long interval = 0;
+	uint32_t seq = 0;
+	int sock, clock_sock;
+
+	if (argc < 5 || argc > 7) {
+		fprintf(stderr, "usage: %s <group> <port> <tiles_h> <tiles_v> [fps [delay]]\n", argv[0]);
+		return 1;
+	}
+
+	tiles_h = atoi(argv[3]);
+	tiles_v = atoi(argv[4]);
+	tile_count = tiles_h * tiles_v;
+	width = tiles_h * DISP_COLS;
+	wall_size = ((size_t)width * tiles_v * DISP_ROWS + 7) / 8;
+
+	if (argc >= 6 && atoi(argv[5]) > 0) {
+		interval = 1000000000L / atoi(argv[5]);
+	}
+
+	if (argc == 7) {
+		delay = atoi(argv[6]) * 1000000ULL;
+	}
+
+	wall = malloc(wall_size);
+	frames = calloc(tile_count, sizeof(*frames));
+	prev = calloc(tile_count, sizeof(*prev));
+
+	if (!tile_count || !wall || !frames || !prev) {
+		return 1;
+	}
+
+	if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+		perror("socket");
+		return 1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(atoi(argv[2]));
+
+	if (inet_aton(argv[1], &addr.sin_addr) == 0) {
+		fprintf(stderr, "invalid group %s\n", argv[1]);
+		return 1;
+	}
+
+	if ((clock_sock = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+		perror("socket");
+		return 1;
+	}
+
+	memset(&clock_addr, 0, sizeof(clock_addr));
+	clock_addr.sin_family = AF_INET;
+	clock_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	clock_addr.sin_port = htons(atoi(argv[2]) + 1);
+
+	if (bind(clock_sock, (struct sockaddr *)&clock_addr, sizeof(clock_addr)) == -1 ||
+		pthread_create(&clock_thread, NULL, clock_server, &clock_sock) != 0) {
+		perror("clock server");
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	start = now() + delay;
+
+	while (fread(wall, wall_size, 1, stdin) == 1) {
+		// paced frames are due at a fixed rate, unpaced ones when read
+		uint64_t pts = interval ? (start + (seq * (uint64_t)interval)) : (now() + delay);
+
+		for (unsigned tile = 0; tile < tile_count; tile++) {
+			flipdot_bitmap_t bitmap;
+			unsigned x0 = (tile % tiles_h) * DISP_COLS;
+			unsigned y0 = (tile / tiles_h) * DISP_ROWS;
+			size_t len;
+
+			memset(bitmap, 0x00, sizeof(bitmap));
+
+			for (unsigned y = 0; y < DISP_ROWS; y++) {
+				for (unsigned x = 0; x < DISP_COLS; x++) {
+					if (ISBITSET(wall, ((size_t)(y0 + y) * width) + x0 + x)) {
+						SETBIT(bitmap, (y * DISP_COLS) + x);
+					}
+				}
+			}
+
+			flipdot_bitmap_to_frame(bitmap, &frames[tile]);
+
+			len = flipdot_net_encode(packet, seq, tile, pts, frames[tile], (seq % KEY_INTERVAL) ? prev[tile] : NULL);
+
+			if (sendto(sock, packet, len, 0, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+				perror("sendto");
+			}
+
+			memcpy(prev[tile], frames[tile], sizeof(prev[tile]));
+		}
+
+		seq++;
+
+		if (interval) {
+			next.tv_nsec += interval;
+			while (next.tv_nsec >= 1000000000L) {
+				next.tv_nsec -= 1000000000L;
+				next.tv_sec++;
+			}
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		}
+	}
+
+	close(sock);
+	return 0;
+}
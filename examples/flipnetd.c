@@ -0,0 +1,383 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "flipdot.h"
+#include "flipdot_net.h"
+
+
+// Receives frame packets for one tile from a multicast group and shows them.
+// With a sender address, the clock is synced to the sender and frames are
+// flipped at their presentation time, otherwise as soon as they arrive.
+// usage: flipnetd <group> <port> <tile> [sender]
+
+// frames waiting for their presentation time
+#define QUEUE_SIZE 8
+
+// call flipdot_update_frame_at() this long before the deadline (ns)
+#define LEAD_TIME 2000000
+
+// clock sync interval and number of samples to pick the best from (ns)
+#define SYNC_INTERVAL 1000000000
+#define SYNC_SAMPLES 8
+
+// start error report interval (ns)
+#define REPORT_INTERVAL 5000000000ULL
+
+// flip counters kept across restarts, see examples/flipwear
+#define WEAR_FILE "/var/tmp/flipdot.wear"
+
+
+static volatile sig_atomic_t running = 1;
+
+static flipdot_frame_t frame;
+static uint8_t synced;
+static uint32_t last_seq;
+static uint8_t dirty;
+
+static struct {
+	flipdot_frame_t frame;
+	uint64_t deadline;
+} queue[QUEUE_SIZE];
+static unsigned queue_head, queue_count;
+
+// clock sync samples, offset is sender clock minus flipdot_now()
+static int64_t sync_offset[SYNC_SAMPLES];
+static uint64_t sync_rtt[SYNC_SAMPLES];
+static unsigned sync_count;
+static int64_t offset;
+static uint64_t rtt;
+
+// refresh rows of the shown frame while no frames come in, see flipdot.h
+static uint64_t next_refresh;
+
+static uint32_t received, lost, shown, late;
+static int64_t error_max;
+static uint64_t error_sum;
+
+
+static void stop(int sig) {
+	(void)sig;
+	running = 0;
+}
+
+static void sync_sample(const uint8_t *packet, uint64_t now) {
+	unsigned best = 0;
+
+	flipdot_net_sync_result(packet, now, &sync_offset[sync_count % SYNC_SAMPLES], &sync_rtt[sync_count % SYNC_SAMPLES]);
+	sync_count++;
+
+	// the sample with the shortest round trip has the smallest error
+	for (unsigned i = 1; i < SYNC_SAMPLES && i < sync_count; i++) {
+		if (sync_rtt[i] < sync_rtt[best]) {
+			best = i;
+		}
+	}
+
+	offset = sync_offset[best];
+	rtt = sync_rtt[best];
+}
+
+static void enqueue(uint64_t pts) {
+	unsigned i;
+
+	if (queue_count == QUEUE_SIZE) {
+		// drop the oldest frame
+		queue_head = (queue_head + 1) % QUEUE_SIZE;
+		queue_count--;
+		late++;
+	}
+
+	i = (queue_head + queue_count) % QUEUE_SIZE;
+	memcpy(queue[i].frame, frame, sizeof(frame));
+	queue[i].deadline = pts - offset;
+	queue_count++;
+}
+
+// apply a packet to frame
+static void handle(const uint8_t *packet, size_t len, uint16_t tile, int clocked) {
+	struct flipdot_net_header header;
+	uint64_t now = flipdot_now();
+
+	if (!flipdot_net_parse(packet, len, &header)) {
+		return;
+	}
+
+	if (header.type == FLIPDOT_NET_SYNC_REPLY) {
+		sync_sample(packet, now);
+		return;
+	}
+
+	if (header.tile != tile || (header.type != FLIPDOT_NET_KEY && header.type != FLIPDOT_NET_DELTA)) {
+		return;
+	}
+
+	received++;
+
+	// duplicate or reordered
+	if (synced && (int32_t)(header.seq - last_seq) <= 0) {
+		return;
+	}
+
+	if (header.type == FLIPDOT_NET_DELTA && (!synced || header.seq != last_seq + 1)) {
+		// missed the frame the delta is based on, wait for the next key frame
+		if (synced) {
+			lost += header.seq - last_seq - 1;
+		}
+		synced = 0;
+		return;
+	}
+
+	if (synced && header.seq != last_seq + 1) {
+		lost += header.seq - last_seq - 1;
+	}
+
+	if (!flipdot_net_apply(packet, &header, &frame)) {
+		synced = 0;
+		return;
+	}
+
+	synced = 1;
+	last_seq = header.seq;
+
+	if (clocked && header.pts && sync_count) {
+		enqueue(header.pts);
+	} else {
+		dirty = 1;
+	}
+}
+
+static void show_due(void) {
+	while (queue_count && queue[queue_head].deadline <= flipdot_now() + LEAD_TIME) {
+		unsigned i = queue_head;
+		unsigned next = (queue_head + 1) % QUEUE_SIZE;
+		int64_t error;
+
+		queue_head = next;
+		queue_count--;
+
+		// skip frames that are already overdue when a newer one is due too
+		if (queue_count && queue[next].deadline <= flipdot_now()) {
+			late++;
+			continue;
+		}
+
+		error = flipdot_update_frame_at(queue[i].frame, queue[i].deadline);
+		shown++;
+		next_refresh = flipdot_now() + (REFRESH_IDLE * 1000000ULL);
+
+		error_sum += (error < 0) ? -error : error;
+		if (error > error_max || -error > error_max) {
+			error_max = (error < 0) ? -error : error;
+		}
+	}
+}
+
+// continue the flip counters of the last run
+static void wear_load(void) {
+	static uint8_t data[FLIPDOT_WEAR_SNAPSHOT_MAX + 1];
+	static flipdot_wear_t wear;
+	FILE *f = fopen(WEAR_FILE, "rb");
+	size_t size;
+
+	if (!f) {
+		return;
+	}
+
+	size = fread(data, 1, sizeof(data), f);
+	fclose(f);
+
+	if (flipdot_wear_load(data, size, &wear)) {
+		flipdot_set_wear(wear);
+	}
+}
+
+static void wear_save(void) {
+	static uint8_t data[FLIPDOT_WEAR_SNAPSHOT_MAX];
+	static flipdot_wear_t wear;
+	FILE *f = fopen(WEAR_FILE, "wb");
+
+	if (!f) {
+		perror(WEAR_FILE);
+		return;
+	}
+
+	flipdot_get_wear(&wear);
+	fwrite(data, 1, flipdot_wear_snapshot(data, wear), f);
+	fclose(f);
+}
+
+static void report(void) {
+	fprintf(stderr, "received %u, lost %u, shown %u, late %u, "
+		"start error mean %lld us max %lld us, offset %lld us, rtt %llu us\n",
+		received, lost, shown, late,
+		shown ? (long long)(error_sum / shown / 1000) : 0LL,
+		(long long)(error_max / 1000), (long long)(offset / 1000), (unsigned long long)(rtt / 1000));
+}
+
+int main(int argc, char **argv) {
+	static uint8_t packet[FLIPDOT_NET_PACKET_MAX + 1];
+	struct sockaddr_in addr, sender;
+	struct ip_mreq mreq;
+	struct sigaction sa;
+	struct pollfd pfd[2];
+	uint64_t next_sync, next_report;
+	uint16_t tile;
+	int clocked = (argc == 5);
+	int one = 1;
+	int sock, sync_sock;
+
+	if (argc != 4 && argc != 5) {
+		fprintf(stderr, "usage: %s <group> <port> <tile> [sender]\n", argv[0]);
+		return 1;
+	}
+
+	tile = atoi(argv[3]);
+
+	if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+		perror("socket");
+		return 1;
+	}
+
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(atoi(argv[2]));
+
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		perror("bind");
+		return 1;
+	}
+
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+
+	if (inet_aton(argv[1], &mreq.imr_multiaddr) == 0 ||
+		setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1) {
+		perror("IP_ADD_MEMBERSHIP");
+		return 1;
+	}
+
+	// the sender answers clock sync requests on port + 1,
+	// replies come back to an own port so several nodes can share a host
+	if ((sync_sock = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+		perror("socket");
+		return 1;
+	}
+
+	memset(&sender, 0, sizeof(sender));
+	sender.sin_family = AF_INET;
+	sender.sin_port = htons(atoi(argv[2]) + 1);
+
+	if (clocked && inet_aton(argv[4], &sender.sin_addr) == 0) {
+		fprintf(stderr, "invalid sender %s\n", argv[4]);
+		return 1;
+	}
+
+	// no SA_RESTART, interrupt poll() to shut down GPIOs on exit
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stop;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if (!flipdot_init())
+		return 1;
+	wear_load();
+	flipdot_clear_to_0();
+
+	// phase counters for examples/flipstat
+	flipdot_phase_stats_shm(FLIPDOT_PHASE_SHM);
+
+	pfd[0].fd = sock;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = sync_sock;
+	pfd[1].events = POLLIN;
+
+	next_sync = flipdot_now();
+	next_report = next_sync + REPORT_INTERVAL;
+	next_refresh = next_sync + (REFRESH_IDLE * 1000000ULL);
+
+	while (running) {
+		uint64_t now = flipdot_now();
+		uint64_t wake;
+		ssize_t len;
+		int timeout;
+
+		if (clocked && now >= next_sync) {
+			// sync quickly until the sample window is full
+			len = flipdot_net_sync_request(packet, now);
+			sendto(sync_sock, packet, len, 0, (struct sockaddr *)&sender, sizeof(sender));
+			next_sync = now + ((sync_count < SYNC_SAMPLES) ? (SYNC_INTERVAL / SYNC_SAMPLES) : SYNC_INTERVAL);
+		}
+
+		if (now >= next_report) {
+			report();
+			next_report = now + REPORT_INTERVAL;
+		}
+
+		if (REFRESH_IDLE && !queue_count && now >= next_refresh) {
+			flipdot_refresh(REFRESH_BUDGET * 1000ULL);
+			next_refresh = flipdot_now() + (REFRESH_IDLE * 1000000ULL);
+		}
+
+		wake = next_report;
+
+		if (REFRESH_IDLE && !queue_count && next_refresh < wake) {
+			wake = next_refresh;
+		}
+
+		if (clocked && next_sync < wake) {
+			wake = next_sync;
+		}
+
+		if (queue_count && queue[queue_head].deadline - LEAD_TIME < wake) {
+			wake = queue[queue_head].deadline - LEAD_TIME;
+		}
+
+		timeout = (wake > now) ? (int)((wake - now + 999999) / 1000000) : 0;
+
+		if (poll(pfd, 2, timeout) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("poll");
+			break;
+		}
+
+		while ((len = recv(sync_sock, packet, sizeof(packet), MSG_DONTWAIT)) > 0) {
+			handle(packet, len, tile, clocked);
+		}
+
+		// apply everything that queued up while flipping
+		while ((len = recv(sock, packet, sizeof(packet), MSG_DONTWAIT)) > 0) {
+			handle(packet, len, tile, clocked);
+		}
+
+		// without presentation times, show only the latest frame
+		if (dirty) {
+			flipdot_update_frame(frame);
+			shown++;
+			dirty = 0;
+			next_refresh = flipdot_now() + (REFRESH_IDLE * 1000000ULL);
+		}
+
+		show_due();
+	}
+
+	flipdot_shutdown();
+	close(sock);
+	close(sync_sock);
+
+	wear_save();
+	report();
+	return 0;
+}
@@ -1,8 +1,7 @@
-#include <bcm2835.h>
 #include "flipdot.h"
 
 int main(void) {
-	if (!bcm2835_init())
+	if (!flipdot_init())
 		return 1;
 
 	flipdot_shutdown();
@@ -35,12 +35,9 @@
 #define LOG_SCALE 20
 #define FFT_SCALE1 1
 
-// disable flipdot output for debugging
-#define NOFLIP
-
+// build with -DNOFLIP to disable flipdot output for debugging
 #ifndef NOFLIP
-#include <bcm2835.h>
-#include <flipdot.h>
+#include "flipdot.h"
 #else
 // flipdot.h would define these constants:
 #define DISP_COLS 40
@@ -73,9 +70,9 @@ static double *time_domain;
 static double *freq_domain;
 
 #ifndef NOFLIP
-// FFT columns are displayed by setting bits in the flipdot row register
-// and selecting only a single column in the col register.
-static uint8_t cols[REGISTER_COL_BYTE_COUNT];
+// FFT columns are drawn into a frame, flipdot_update_frame()
+// flips only the changed bars
+static flipdot_frame_t frame;
 #endif
 
 // keep the last values to calculate the difference
@@ -267,8 +264,9 @@ int main(int argc, char **argv) {
 			return 1;
 		}
 
-		if (!bcm2835_init()) {
-			fprintf(stderr, "bcm2835_init failed\n");
+		// the backend maps the GPIOs before privileges are dropped
+		if (!flipdot_init()) {
+			fprintf(stderr, "flipdot_init failed\n");
 			return 1;
 		}
 
@@ -386,8 +384,10 @@ int main(int argc, char **argv) {
 
 #ifndef NOFLIP
 	if (!noflip) {
-		flipdot_init();
 		flipdot_clear_to_0();
+
+		// flip only what fits into one audio period, so reading never falls behind
+		flipdot_governor_init(((uint64_t)frames * 1000000000) / val);
 	}
 #endif
 
@@ -524,20 +524,15 @@ int main(int argc, char **argv) {
 
 #ifndef NOFLIP
 			if (!noflip) {
-				// https://wiki.attraktor.org/FlipdotDisplay#Logisch
-
-				// black -> white (OE0)
-				if (rows_to_0) {
-					memset(cols, 0xFF, sizeof(cols));
-					CLEARBIT(cols, i + ((i / MODULE_COLS) * COL_GAP));
-					flipdot_display_row_single((uint8_t *)&rows_to_0, cols, 0);
-				}
-
-				// white -> black (OE1)
-				if (rows_to_1) {
-					memset(cols, 0x00, sizeof(cols));
-					SETBIT(cols, i + ((i / MODULE_COLS) * COL_GAP));
-					flipdot_display_row_single((uint8_t *)&rows_to_1, cols, 1);
+				// copy the bar into its frame column
+				unsigned int col = i + ((i / MODULE_COLS) * COL_GAP);
+
+				for (unsigned int row = 0; row < FFT_HEIGHT; row++) {
+					if (rows_new & (1 << row)) {
+						SETBIT(frame, (row * REGISTER_COLS) + col);
+					} else {
+						CLEARBIT(frame, (row * REGISTER_COLS) + col);
+					}
 				}
 			}
 #endif
@@ -550,6 +545,24 @@ int main(int argc, char **argv) {
 		}
 
 
+#ifndef NOFLIP
+		if (!noflip) {
+			// the library picks the cheaper of row-major and column-major scans.
+			// bars mostly change in few columns, so this usually flips by column
+			if (verbose) {
+				gettimeofday(&tv4, NULL);
+			}
+
+			flipdot_governor_update_frame(frame);
+
+			if (verbose) {
+				gettimeofday(&tv0, NULL);
+				cur_usec4 += ((tv0.tv_sec*1000000) + tv0.tv_usec) - ((tv4.tv_sec*1000000) + tv4.tv_usec);
+			}
+		}
+#endif
+
+
 		if (verbose) {
 			max_changes = MAX(max_changes, rows_changed_0 + rows_changed_1);
 
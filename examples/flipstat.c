@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "flipdot.h"
+
+
+// Polls the per-phase counters a display process shares with
+// flipdot_phase_stats_shm() and prints the phases of each interval.
+// usage: flipstat [interval ms [shm name]]
+
+static const char *phase_names[FLIPDOT_PHASE_COUNT] = {
+	"diff", "shift", "strobe", "oe wait", "flip 0", "flip 1", "flip wait", "frame"
+};
+
+
+// same seqlock reader as flipdot_get_phase_stats()
+static void
+read_stats(const struct flipdot_phase_stats *src, struct flipdot_phase_stats *stats)
+{
+	uint32_t seq;
+
+	do {
+		seq = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+		memcpy(stats, src, sizeof(*stats));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || seq != __atomic_load_n(&src->seq, __ATOMIC_RELAXED));
+}
+
+int main(int argc, char **argv) {
+	const char *name = (argc > 2) ? argv[2] : FLIPDOT_PHASE_SHM;
+	unsigned interval = (argc > 1) ? atoi(argv[1]) : 1000;
+	struct flipdot_phase_stats *shm, last, now;
+	int fd;
+
+	if (argc > 3 || interval == 0) {
+		fprintf(stderr, "usage: %s [interval ms [shm name]]\n", argv[0]);
+		return 1;
+	}
+
+	if ((fd = shm_open(name, O_RDONLY, 0)) == -1) {
+		perror(name);
+		return 1;
+	}
+
+	shm = mmap(NULL, sizeof(*shm), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (shm == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	if (shm->size != sizeof(*shm)) {
+		fprintf(stderr, "%s: counters of a different library version\n", name);
+		return 1;
+	}
+
+	read_stats(shm, &last);
+
+	for (;;) {
+		usleep(interval * 1000);
+		read_stats(shm, &now);
+
+		printf("%-10s %10s %12s %10s %7s\n", "phase", "count", "time ms", "mean us", "busy");
+
+		for (unsigned i = 0; i < FLIPDOT_PHASE_COUNT; i++) {
+			uint64_t count = now.phase[i].count - last.phase[i].count;
+			uint64_t time = now.phase[i].time - last.phase[i].time;
+
+			printf("%-10s %10llu %12.3f %10.1f %6.1f%%\n", phase_names[i],
+				(unsigned long long)count, time / 1e6,
+				count ? (time / 1e3) / count : 0.0,
+				(time / 1e4) / interval);
+		}
+
+		putchar('\n');
+		fflush(stdout);
+		last = now;
+	}
+
+	return 0;
+}
@@ -6,7 +6,6 @@
 #include <sys/param.h>
 #include <time.h>
 #include <signal.h>
-#include <bcm2835.h>
 #include "flipdot.h"
 
 
@@ -17,12 +16,10 @@ flipdot_bitmap_t bmp;
 
 
 int main(void) {
-	if (!bcm2835_init())
-		return 1;
-
 #if 1
 	puts("flipdot_init()");
-	flipdot_init();
+	if (!flipdot_init())
+		return 1;
 //	sleep(5);
 #endif
 
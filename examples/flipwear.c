@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "flipdot.h"
+
+
+// Converts a flip counter snapshot, e.g. the one flipnetd saves on exit,
+// into a PGM heatmap and prints the most and least flipped dots.
+// usage: flipwear <snapshot> >heatmap.pgm
+
+int main(int argc, char **argv) {
+	static uint8_t data[FLIPDOT_WEAR_SNAPSHOT_MAX + 1];
+	static uint8_t pgm[FLIPDOT_WEAR_PGM_MAX];
+	static flipdot_wear_t wear;
+	unsigned max = 0, min = 0, idle = 0;
+	uint64_t total = 0;
+	size_t size;
+	FILE *f;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s <snapshot> >heatmap.pgm\n", argv[0]);
+		return 1;
+	}
+
+	if ((f = fopen(argv[1], "rb")) == NULL) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	size = fread(data, 1, sizeof(data), f);
+	fclose(f);
+
+	if (!flipdot_wear_load(data, size, &wear)) {
+		fprintf(stderr, "%s: not a snapshot for %d x %d pixels\n", argv[1], DISP_COLS, DISP_ROWS);
+		return 1;
+	}
+
+	for (unsigned i = 0; i < DISP_PIXEL_COUNT; i++) {
+		total += wear[i];
+		idle += (wear[i] == 0);
+
+		if (wear[i] > wear[max]) {
+			max = i;
+		}
+		if (wear[i] < wear[min]) {
+			min = i;
+		}
+	}
+
+	fprintf(stderr, "flips %llu, mean %.1f, max %u at %u,%u, min %u at %u,%u, %u dots never flipped\n",
+		(unsigned long long)total, (double)total / DISP_PIXEL_COUNT,
+		wear[max], max % DISP_COLS, max / DISP_COLS,
+		wear[min], min % DISP_COLS, min / DISP_COLS, idle);
+
+	fwrite(pgm, 1, flipdot_wear_pgm(pgm, wear), stdout);
+
+	return 0;
+}
@@ -2,376 +2,917 @@
 #include <string.h>
 #include <time.h>
 #include <errno.h>
-#include <bcm2835.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "flipdot.h"
+#include "flipdot_hw.h"
+
+#if PHASE_TRACE
+#include <sys/sdt.h>
+#endif
 
 
 #define SETBIT(b,i) ((((uint8_t *)(b))[(i) >> 3]) |= (1 << ((i) & 7)))
+#define CLRBIT(b,i) ((((uint8_t *)(b))[(i) >> 3]) &= ~(1 << ((i) & 7)))
 #define ISBITSET(b,i) (((((uint8_t *)(b))[(i) >> 3]) & (1 << ((i) & 7))) != 0)
 
 #ifndef _BV
 #define _BV(x) (1 << (x))
 #endif
 
+#define NO_GROUP UINT_FAST16_MAX
+
+
+#ifndef HW_DEFAULT
+#define HW_DEFAULT flipdot_hw_bcm2835
+#endif
+
+
+#define PULSE_MAX (2 * ((REGISTER_ROWS > REGISTER_COLS) ? (REGISTER_ROWS) : (REGISTER_COLS)))
+
+
+#define PHASES (PHASE_STATS || PHASE_TRACE)
+
+
+static const struct flipdot_hw *hw = &HW_DEFAULT;
+
+// register contents and polarity of a single flip pulse
+struct pulse {
+	flipdot_row_reg_t rows;
+	flipdot_col_reg_t cols;
+	uint8_t oe;
+};
+
 
 static flipdot_frame_t frames[2];
 static flipdot_frame_t *frame_old, *frame_new;
 
+static struct pulse pulses[PULSE_MAX];
+
+// OE pulse in progress
+static uint_fast8_t pulse_active;
+static uint8_t pulse_oe;
+static uint64_t pulse_start;
+static uint64_t pulse_end;
+
+static struct flipdot_timing_stats timing_stats;
+
+// time OE0 and OE1 were last cleared
+static uint64_t oe_off[2];
+
+// next row of flipdot_refresh()
+static uint_fast16_t refresh_row;
+
+// deadline for the next pulse to start, 0 for none
+static uint64_t start_at;
+static int64_t start_error;
+
+// per-phase counters, moved to shared memory by flipdot_phase_stats_shm()
+static struct flipdot_phase_stats phase_local = { .size = sizeof(struct flipdot_phase_stats) };
+static struct flipdot_phase_stats *phase_stats = &phase_local;
+
+#if WEAR_STATS
+// Bit-sliced flip counters: bit i of wear_planes[n] is bit n of the flips
+// of frame pixel i since the planes were last added to wear_counts.
+// An update adds its XOR mask to 64 pixels at a time, the planes are
+// added to wear_counts before they can overflow.
+#define WEAR_PLANES 8
+#define WEAR_WORDS ((FRAME_BYTE_COUNT + 7) / 8)
+
+static uint64_t wear_planes[WEAR_PLANES][WEAR_WORDS];
+static uint32_t wear_pending;
+static uint32_t wear_counts[FRAME_PIXEL_COUNT];
+static uint64_t wear_total;
+#endif
+
 
 static void
 _nanosleep(long nsec)
 {
 	struct timespec req;
 
+	if (hw->sleep) {
+		hw->sleep(nsec);
+		return;
+	}
+
 	req.tv_sec = 0;
 	req.tv_nsec = nsec;
 
 	while (nanosleep(&req, &req) == -1 && errno == EINTR);
 }
 
-static void
-_microsleep(uint64_t micros)
+static uint64_t
+_now(void)
 {
-	_nanosleep(micros * 1000);
-/*
-	// busy loop on the bcm2835 system timer
-	uint64_t compare = bcm2835_st_read() + micros;
-	while(bcm2835_st_read() < compare);
-*/
+	struct timespec ts;
+
+	if (hw->now) {
+		return hw->now();
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
 }
 
+// Sleep until SPIN_DELAY before the deadline, then busy wait.
+// Simulated backends have no scheduler latency and sleep all the way.
 static void
-_hw_init(void)
-{
-	// clear ports
-#ifdef GPIO_MULTI
-	bcm2835_gpio_clr_multi(
-		_BV(OE0) | _BV(OE1) | _BV(STROBE) |
-		_BV(ROW_DATA) | _BV(ROW_CLK) |
-		_BV(COL_DATA) | _BV(COL_CLK));
-#else
-	bcm2835_gpio_clr(OE0);
-	bcm2835_gpio_clr(OE1);
-	bcm2835_gpio_clr(STROBE);
-	bcm2835_gpio_clr(ROW_DATA);
-	bcm2835_gpio_clr(ROW_CLK);
-	bcm2835_gpio_clr(COL_DATA);
-	bcm2835_gpio_clr(COL_CLK);
+_sleep_until(uint64_t deadline)
+{
+	uint64_t now = _now();
+
+	if (now >= deadline) {
+		return;
+	}
+
+	if (hw->sleep) {
+		_nanosleep(deadline - now);
+		return;
+	}
+
+	if (deadline - now > (SPIN_DELAY * 1000)) {
+		_nanosleep(deadline - now - (SPIN_DELAY * 1000));
+	}
+
+	while (_now() < deadline);
+}
+
+static inline void _hw_set(uint8_t gpio) { hw->set_multi(1 << gpio); }
+static inline void _hw_clr(uint8_t gpio) { hw->clr_multi(1 << gpio); }
+
+
+// Phase instrumentation
+// Without PHASE_STATS and PHASE_TRACE, phase_time() is a constant and
+// phase_add() is empty, so the compiler drops all of it.
+
+static inline uint64_t
+phase_time(void)
+{
+	return PHASES ? _now() : 0;
+}
+
+static inline void
+phase_add(uint_fast8_t id, uint64_t count, uint64_t start, uint64_t end)
+{
+#if PHASE_STATS
+	struct flipdot_phase_stats *stats = phase_stats;
+
+	// single writer seqlock
+	__atomic_store_n(&stats->seq, stats->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	stats->phase[id].count += count;
+	stats->phase[id].time += end - start;
+
+	__atomic_store_n(&stats->seq, stats->seq + 1, __ATOMIC_RELEASE);
+#endif
+
+#if PHASE_TRACE
+	DTRACE_PROBE4(flipdot, phase, id, count, start, end);
 #endif
 
-	// set ports to output
-	bcm2835_gpio_fsel(OE0, BCM2835_GPIO_FSEL_OUTP);
-	bcm2835_gpio_fsel(OE1, BCM2835_GPIO_FSEL_OUTP);
-	bcm2835_gpio_fsel(STROBE, BCM2835_GPIO_FSEL_OUTP);
-	bcm2835_gpio_fsel(ROW_DATA, BCM2835_GPIO_FSEL_OUTP);
-	bcm2835_gpio_fsel(ROW_CLK, BCM2835_GPIO_FSEL_OUTP);
-	bcm2835_gpio_fsel(COL_DATA, BCM2835_GPIO_FSEL_OUTP);
-	bcm2835_gpio_fsel(COL_CLK, BCM2835_GPIO_FSEL_OUTP);
-
-	// TODO: is this really useful? better use external pull-down
-	bcm2835_gpio_set_pud(OE0, BCM2835_GPIO_PUD_DOWN  );
-	bcm2835_gpio_set_pud(OE1, BCM2835_GPIO_PUD_DOWN  );
-	bcm2835_gpio_set_pud(STROBE, BCM2835_GPIO_PUD_DOWN  );
-	bcm2835_gpio_set_pud(ROW_DATA, BCM2835_GPIO_PUD_DOWN  );
-	bcm2835_gpio_set_pud(ROW_CLK, BCM2835_GPIO_PUD_DOWN  );
-	bcm2835_gpio_set_pud(COL_DATA, BCM2835_GPIO_PUD_DOWN  );
-	bcm2835_gpio_set_pud(COL_CLK, BCM2835_GPIO_PUD_DOWN  );
+	(void)id;
+	(void)count;
+	(void)start;
+	(void)end;
 }
 
-static void
-_hw_shutdown(void)
-{
-	// clear ports
-#ifdef GPIO_MULTI
-	bcm2835_gpio_clr_multi(
-		_BV(OE0) | _BV(OE1) | _BV(STROBE) |
-		_BV(ROW_DATA) | _BV(ROW_CLK) |
-		_BV(COL_DATA) | _BV(COL_CLK));
+
+// frame pixel of bitmap pixel x, y
+static inline uint_fast16_t
+frame_pixel(uint_fast16_t x, uint_fast16_t y)
+{
+	return (y * REGISTER_COLS) + ((x / MODULE_COLS) * (MODULE_COLS + COL_GAP)) + (x % MODULE_COLS);
+}
+
+
+// Flip counters
+
+#if WEAR_STATS
+
+// bit of a plane word holding frame pixel i, words are loaded in host byte order
+static inline uint_fast8_t
+wear_bit(uint_fast16_t i)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return (i % 64) ^ 56;
 #else
-	bcm2835_gpio_clr(OE0);
-	bcm2835_gpio_clr(OE1);
-	bcm2835_gpio_clr(STROBE);
-	bcm2835_gpio_clr(ROW_DATA);
-	bcm2835_gpio_clr(ROW_CLK);
-	bcm2835_gpio_clr(COL_DATA);
-	bcm2835_gpio_clr(COL_CLK);
+	return i % 64;
 #endif
+}
 
-	// set ports to input
-	// TODO: disable pull-ups?
-	bcm2835_gpio_fsel(OE0, BCM2835_GPIO_FSEL_INPT);
-	bcm2835_gpio_fsel(OE1, BCM2835_GPIO_FSEL_INPT);
-	bcm2835_gpio_fsel(STROBE, BCM2835_GPIO_FSEL_INPT);
-	bcm2835_gpio_fsel(ROW_DATA, BCM2835_GPIO_FSEL_INPT);
-	bcm2835_gpio_fsel(ROW_CLK, BCM2835_GPIO_FSEL_INPT);
-	bcm2835_gpio_fsel(COL_DATA, BCM2835_GPIO_FSEL_INPT);
-	bcm2835_gpio_fsel(COL_CLK, BCM2835_GPIO_FSEL_INPT);
+static inline void
+wear_add_word(uint_fast16_t w, uint64_t carry)
+{
+	wear_total += __builtin_popcountll(carry);
+
+	// ripple carry adder across the planes
+	for (uint_fast8_t n = 0; carry && n < WEAR_PLANES; n++) {
+		uint64_t next = wear_planes[n][w] & carry;
+
+		wear_planes[n][w] ^= carry;
+		carry = next;
+	}
 }
 
-#ifdef GPIO_MULTI
 static void
-_hw_set_multi(uint32_t mask)
+wear_flush(void)
 {
-	bcm2835_gpio_set_multi(mask);
+	for (uint_fast8_t n = 0; n < WEAR_PLANES; n++) {
+		for (uint_fast16_t w = 0; w < WEAR_WORDS; w++) {
+			for (uint_fast16_t i = w * 64; i < (w + 1) * 64 && i < FRAME_PIXEL_COUNT; i++) {
+				wear_counts[i] += ((wear_planes[n][w] >> wear_bit(i)) & 1) << n;
+			}
+		}
+	}
+
+	memset(wear_planes, 0, sizeof(wear_planes));
+	wear_pending = 0;
 }
 
+#endif
+
+// count the dots that change from frame old to frame new in bytes first to end - 1
 static void
-_hw_clr_multi(uint32_t mask)
+wear_add(const uint8_t *old, const uint8_t *new, uint_fast16_t first, uint_fast16_t end)
 {
-	bcm2835_gpio_clr_multi(mask);
-}
+#if WEAR_STATS
+	for (uint_fast16_t w = first / 8; w * 8 < end; w++) {
+		uint_fast16_t lo = (w * 8 > first) ? (w * 8) : first;
+		uint_fast16_t hi = ((w * 8) + 8 < end) ? ((w * 8) + 8) : end;
+		uint64_t a = 0, b = 0;
+
+		if (hi - lo == 8) {
+			memcpy(&a, old + lo, 8);
+			memcpy(&b, new + lo, 8);
+		} else {
+			memcpy((uint8_t *)&a + (lo % 8), old + lo, hi - lo);
+			memcpy((uint8_t *)&b + (lo % 8), new + lo, hi - lo);
+		}
 
-static inline void _hw_set(uint8_t gpio) { _hw_set_multi(1 << gpio); }
-static inline void _hw_clr(uint8_t gpio) { _hw_clr_multi(1 << gpio); }
+		if (a != b) {
+			wear_add_word(w, a ^ b);
+		}
+	}
 
+	if (++wear_pending == (1 << WEAR_PLANES) - 1) {
+		wear_flush();
+	}
 #else
+	(void)old;
+	(void)new;
+	(void)first;
+	(void)end;
+#endif
+}
+
+
+// Flip pulses run in the background of the shift register loading:
+// flip_start() sets OE, the next pulse is shifted in while the dots move
+// and flip_finish() waits for the rest of FLIP_DELAY.
+// The output latches only change on STROBE, so the shift registers are
+// free to take new data during the pulse.
 
 static void
-_hw_set(uint8_t gpio)
+timing_record(uint64_t width)
 {
-	bcm2835_gpio_set(gpio);
+	uint64_t over = (width > (FLIP_DELAY * 1000)) ? ((width - (FLIP_DELAY * 1000)) / 1000) : 0;
+	uint_fast8_t bin = 0;
+
+	// bin 0: less than 1us too long, bin n: 2^(n-1) to 2^n - 1 us too long
+	if (over) {
+		bin = 64 - __builtin_clzll(over);
+		if (bin >= FLIPDOT_TIMING_BINS) {
+			bin = FLIPDOT_TIMING_BINS - 1;
+		}
+	}
+
+	timing_stats.hist[bin]++;
+	timing_stats.pulses++;
+	timing_stats.total_width += width;
+
+	if (width > timing_stats.max_width) {
+		timing_stats.max_width = width;
+	}
+
+	if (!timing_stats.min_width || width < timing_stats.min_width) {
+		timing_stats.min_width = width;
+	}
 }
 
 static void
-_hw_clr(uint8_t gpio)
+flip_end(void)
 {
-	bcm2835_gpio_clr(gpio);
+	_hw_clr((pulse_oe == 0) ? OE0 : OE1);
+	oe_off[pulse_oe] = _now();
+	pulse_active = 0;
+
+	timing_record(oe_off[pulse_oe] - pulse_start);
+	phase_add((pulse_oe == 0) ? FLIPDOT_PHASE_FLIP_0 : FLIPDOT_PHASE_FLIP_1, 1, pulse_start, oe_off[pulse_oe]);
 }
 
-#endif
+// OE pulses can still be stretched if the thread is preempted
+// during the busy wait, run with a realtime priority to prevent it
+static void
+flip_start(uint8_t oe)
+{
+	// OE_DELAY dead time is only needed after a pulse of the other polarity
+	uint64_t not_before = oe_off[!oe] + (OE_DELAY * 1000);
+	uint64_t wait = phase_time();
 
+	if (start_at > not_before) {
+		not_before = start_at;
+	}
+
+	_sleep_until(not_before);
+	phase_add(FLIPDOT_PHASE_OE_WAIT, 1, wait, phase_time());
+
+	_hw_set((oe == 0) ? OE0 : OE1);
+
+	pulse_oe = oe;
+	pulse_start = _now();
+	pulse_end = pulse_start + (FLIP_DELAY * 1000);
+	pulse_active = 1;
+
+	if (start_at) {
+		start_error = pulse_start - start_at;
+		start_at = 0;
+	}
+}
 
+// end the pulse on time if shifting takes longer than FLIP_DELAY
 static void
-sreg_strobe(void)
+flip_poll(void)
 {
-	_hw_set(STROBE);
+	if (pulse_active && _now() >= pulse_end) {
+		flip_end();
+	}
+}
 
-#ifndef NOSLEEP
-	_nanosleep(STROBE_DELAY);
-#endif
+static void
+flip_finish(void)
+{
+	if (pulse_active) {
+		uint64_t wait = phase_time();
+
+		_sleep_until(pulse_end);
+		phase_add(FLIPDOT_PHASE_FLIP_WAIT, 1, wait, phase_time());
 
-	_hw_clr(STROBE);
+		flip_end();
+	}
 }
 
-static void
-sreg_clk_col(void) {
-#ifndef NOSLEEP
-			_nanosleep(DATA_DELAY);
-#endif
+// Waveform programs
+// The shift register loading, strobes and pulses of a list of pulses are
+// compiled into GPIO writes first and played back in a tight loop,
+// without any per-bit decisions between the clock edges.
 
-	_hw_set(COL_CLK);
+#define WAVE_WRITE 0
+#define WAVE_STROBE 1
+#define WAVE_PULSE_START 2
+#define WAVE_PULSE_END 3
 
-#ifndef NOSLEEP
-	_nanosleep(CLK_DELAY);
-#endif
+// ops to strobe, flip and shift the next pulse
+#define WAVE_SHIFT_BITS ((REGISTER_ROWS > CHAIN_COLS) ? (REGISTER_ROWS) : (CHAIN_COLS))
+#define WAVE_PULSE_OPS ((2 * WAVE_SHIFT_BITS) + 5)
+#define WAVE_PULSES 8
+#define WAVE_MAX (WAVE_PULSES * WAVE_PULSE_OPS)
 
-#ifdef GPIO_MULTI
-	_hw_clr_multi(_BV(COL_CLK) | _BV(COL_DATA));
+#ifdef NOSLEEP
+#define WAVE_DELAY(ns) 0
 #else
-	_hw_clr(COL_CLK);
+#define WAVE_DELAY(ns) (ns)
 #endif
 
-#ifndef NOSLEEP
-//	_nanosleep(CLK_DELAY);
-#endif
-}
+
+struct wave_op {
+	uint32_t clr;	// GPIOs to clear, written first
+	uint32_t set;	// GPIOs to set
+	uint16_t delay;	// ns to wait after the write
+	uint8_t type;
+	uint8_t oe;
+};
+
+static struct wave_op wave[WAVE_MAX];
+
+static const uint8_t chain_row_data[CHAIN_COUNT] = { CHAIN_ROW_DATA };
+static const uint8_t chain_col_data[CHAIN_COUNT] = { CHAIN_COL_DATA };
+
+// all chains get the same rows
+static uint32_t row_data_mask;
+
+// register contents as last shifted, unknown until the first full shift
+static flipdot_row_reg_t shift_rows;
+static flipdot_col_reg_t shift_cols;
+static uint_fast8_t shift_valid;
+
+// row data and per chain column data masks of the bits of a nibble, MSB first
+static uint32_t row_nibble_masks[16][4];
+static uint32_t col_nibble_masks[CHAIN_COUNT][16][4];
+
 
 static void
-sreg_shift_col_bits(uint16_t data, uint_fast16_t count)
+wave_init(void)
 {
-	uint32_t d = data; // produces faster bit test in the loop
+	row_data_mask = 0;
 
-	while (count--) {
-		if (d & (1 << count)) {
-			_hw_set(COL_DATA);
-			sreg_clk_col();
-		} else {
-#ifndef GPIO_MULTI
-			_hw_clr(COL_DATA);
-#endif
-			sreg_clk_col();
+	for (uint_fast8_t chain = 0; chain < CHAIN_COUNT; chain++) {
+		row_data_mask |= _BV(chain_row_data[chain]);
+	}
+
+	for (uint_fast8_t n = 0; n < 16; n++) {
+		for (uint_fast8_t j = 0; j < 4; j++) {
+			uint32_t bit = (n >> (3 - j)) & 1;
+
+			row_nibble_masks[n][j] = bit * row_data_mask;
+
+			for (uint_fast8_t chain = 0; chain < CHAIN_COUNT; chain++) {
+				col_nibble_masks[chain][n][j] = bit << chain_col_data[chain];
+			}
 		}
 	}
 }
 
-static void
-sreg_fill_col(const uint8_t *col_data, uint_fast16_t col_count)
+
+static struct wave_op *
+wave_write(struct wave_op *op, uint32_t clr, uint32_t set, uint16_t delay)
 {
-	uint_fast16_t i;
+	op->clr = clr;
+	op->set = set;
+	op->delay = delay;
+	op->type = WAVE_WRITE;
 
-#ifdef GPIO_MULTI
-	// COL_DATA is cleared after clock cycle, pre-set to 0
-	_hw_clr(COL_DATA);
-#endif
+	return op + 1;
+}
 
-	// process the last col_count % 16 bits
-	if (col_count & 0x0f) {
-		sreg_shift_col_bits(((uint16_t *)col_data)[col_count >> 4], col_count & 0x0f);
-	}
+static struct wave_op *
+wave_clock(struct wave_op *op, uint32_t *last, uint32_t data, uint32_t clk)
+{
+	// clear the last clock and data bits that drop, set the rising ones
+	op = wave_write(op, *last & ~data, data & ~*last, WAVE_DELAY(DATA_DELAY));
+	op = wave_write(op, 0, clk, WAVE_DELAY(CLK_DELAY));
 
-	// process bits in chunks of 16
-	i = col_count >> 4;
-	while (i--) {
-		sreg_shift_col_bits(((uint16_t *)col_data)[i], 16);
-	}
+	*last = data | clk;
+	return op;
 }
 
-static void
-sreg_shift_both_bits(uint16_t row_data, uint_fast16_t row_count, uint16_t col_data, uint_fast16_t col_count)
+// Shift the row_count lowest bits of rows and the col_count lowest
+// bits of the cols of all chains MSB first, the last bits of all
+// registers are clocked together. A count of 0 leaves a register untouched.
+// Whole nibbles are looked up in the data mask tables, only a nibble
+// with a register end inside is built bit by bit.
+static struct wave_op *
+wave_shift(struct wave_op *op, const uint8_t *rows, uint_fast16_t row_count, const uint8_t *cols, uint_fast16_t col_count)
 {
-	while (row_count || col_count) {
+	uint_fast16_t count = (row_count > col_count) ? row_count : col_count;
+	uint32_t last = 0;
 
-#ifdef GPIO_MULTI
-		uint32_t bits_to_1 = ((row_count && (row_data & (1 << (row_count-1))))?(_BV(ROW_DATA)):(0)) |
-							((col_count && (col_data & (1 << (col_count-1))))?(_BV(COL_DATA)):(0));
+	for (uint_fast16_t k = (count + 3) / 4; k-- > 0;) {
+		uint_fast16_t lo = k * 4;
+		uint_fast8_t shift = (k & 1) * 4;
 
-		if (bits_to_1) {
-			_hw_set_multi(bits_to_1);
-		}
-#else
-		if (row_count) {
-			if (ISBITSET(row_data, row_count - 1)) {
-				_hw_set(ROW_DATA);
-			} else {
-				_hw_clr(ROW_DATA);
+		if ((lo + 4 <= row_count || lo >= row_count) && (lo + 4 <= col_count || lo >= col_count)) {
+			uint32_t data[4] = { 0, 0, 0, 0 };
+			uint32_t clk = 0;
+
+			if (lo < row_count) {
+				const uint32_t *row_data = row_nibble_masks[(rows[k >> 1] >> shift) & 0xf];
+
+				for (uint_fast8_t j = 0; j < 4; j++) {
+					data[j] |= row_data[j];
+				}
+				clk |= _BV(ROW_CLK);
 			}
-		}
 
-		if (col_count) {
-			if (ISBITSET(col_data, col_count - 1)) {
-				_hw_set(COL_DATA);
-			} else {
-				_hw_clr(COL_DATA);
+			if (lo < col_count) {
+				for (uint_fast8_t chain = 0; chain < CHAIN_COUNT; chain++) {
+					const uint8_t *chain_cols = cols + (chain * CHAIN_COL_BYTE_COUNT);
+					const uint32_t *col_data = col_nibble_masks[chain][(chain_cols[k >> 1] >> shift) & 0xf];
+
+					for (uint_fast8_t j = 0; j < 4; j++) {
+						data[j] |= col_data[j];
+					}
+				}
+				clk |= _BV(COL_CLK);
+			}
+
+			for (uint_fast8_t j = 0; j < 4; j++) {
+				op = wave_clock(op, &last, data[j], clk);
+			}
+		} else {
+			for (uint_fast16_t bit = lo + 4; bit-- > lo;) {
+				uint32_t data = 0;
+				uint32_t clk = 0;
+
+				if (bit < row_count) {
+					clk |= _BV(ROW_CLK);
+					if (ISBITSET(rows, bit)) {
+						data |= row_data_mask;
+					}
+				}
+
+				if (bit < col_count) {
+					clk |= _BV(COL_CLK);
+					for (uint_fast8_t chain = 0; chain < CHAIN_COUNT; chain++) {
+						if (ISBITSET(cols + (chain * CHAIN_COL_BYTE_COUNT), bit)) {
+							data |= _BV(chain_col_data[chain]);
+						}
+					}
+				}
+
+				if (clk) {
+					op = wave_clock(op, &last, data, clk);
+				}
 			}
 		}
-#endif
+	}
 
-#ifndef NOSLEEP
-		_nanosleep(DATA_DELAY);
-#endif
+	if (last) {
+		op = wave_write(op, last, 0, 0);
+	}
 
-#ifdef GPIO_MULTI
-		_hw_set_multi( ((row_count)?(_BV(ROW_CLK)):(0)) | ((col_count)?(_BV(COL_CLK)):(0)));
-#else
-		if (row_count) {
-			_hw_set(ROW_CLK);
-		}
+	return op;
+}
 
-		if (col_count) {
-			_hw_set(COL_CLK);
-		}
-#endif
+// 32 bits of a register of size bytes starting at bit pos,
+// bits past the end are 0
+static uint32_t
+reg_bits(const uint8_t *reg, uint_fast16_t size, uint_fast16_t pos)
+{
+	uint_fast16_t byte = pos / 8;
+	uint64_t v = 0;
 
-#ifndef NOSLEEP
-		_nanosleep(CLK_DELAY);
-#endif
+	for (uint_fast8_t i = 0; i < 5 && byte + i < size; i++) {
+		v |= (uint64_t)reg[byte + i] << (i * 8);
+	}
 
-#ifdef GPIO_MULTI
-		_hw_clr_multi(_BV(ROW_CLK) | _BV(COL_CLK) | _BV(ROW_DATA) | _BV(COL_DATA));
-#else
-		if (row_count) {
-			_hw_clr(ROW_CLK);
-		}
+	return v >> (pos % 8);
+}
+
+// Check if shifting n bits into a register of count bits leaves the
+// bits of "to" above n, i.e. bit i of "to" equals bit i - n of "from"
+static uint_fast8_t
+shift_keeps(const uint8_t *from, const uint8_t *to, uint_fast16_t size, uint_fast16_t count, uint_fast16_t n)
+{
+	for (uint_fast16_t i = n; i < count; i += 32) {
+		uint32_t mask = (count - i < 32) ? ((1UL << (count - i)) - 1) : 0xFFFFFFFF;
 
-		if (col_count) {
-			_hw_clr(COL_CLK);
+		if ((reg_bits(to, size, i) ^ reg_bits(from, size, i - n)) & mask) {
+			return 0;
 		}
-#endif
+	}
+
+	return 1;
+}
 
-		if (row_count) {
-			row_count--;
+// Least number of clocks that turn regs registers of count bits from
+// "from" into "to" when they are clocked together
+static uint_fast16_t
+shift_count(const uint8_t *from, const uint8_t *to, uint_fast16_t size, uint_fast16_t count, uint_fast8_t regs)
+{
+	for (uint_fast16_t n = 0; n < count; n++) {
+		uint_fast8_t r = 0;
+
+		while (r < regs && shift_keeps(from + (r * size), to + (r * size), size, count, n)) {
+			r++;
 		}
 
-		if (col_count) {
-			col_count--;
+		if (r == regs) {
+			return n;
 		}
 	}
+
+	return count;
 }
 
-static void
-sreg_fill_both(const uint8_t *row_data, uint_fast16_t row_count, const uint8_t *col_data, uint_fast16_t col_count)
+// Shift only the bits of pulse p that are not in the registers yet,
+// e.g. a single row clock to walk the selected row down by one
+static struct wave_op *
+wave_load(struct wave_op *op, const struct pulse *p)
 {
-#ifdef GPIO_MULTI
-	// ROW_DATA and COL_DATA are cleared after clock cycle, pre-set to 0
-	_hw_clr_multi(_BV(ROW_DATA) | _BV(COL_DATA));
-#endif
+	uint_fast16_t row_count = REGISTER_ROWS;
+	uint_fast16_t col_count = CHAIN_COLS;
 
-	// process the last count % 16 bits
-	if (row_count & 0x0f || col_count & 0x0f) {
-		sreg_shift_both_bits(((uint16_t *)row_data)[row_count >> 4], row_count & 0x0f,
-							((uint16_t *)col_data)[col_count >> 4], col_count & 0x0f);
+	if (shift_valid) {
+		row_count = shift_count(shift_rows, p->rows, REGISTER_ROW_BYTE_COUNT, REGISTER_ROWS, 1);
+		col_count = shift_count(shift_cols, p->cols, CHAIN_COL_BYTE_COUNT, CHAIN_COLS, CHAIN_COUNT);
 	}
 
-	// process bits in chunks of 16
-	row_count = row_count >> 4;
-	col_count = col_count >> 4;
-	while (row_count || col_count) {
-		if (row_count && col_count) {
-			sreg_shift_both_bits(((uint16_t *)row_data)[row_count-1], 16,
-								((uint16_t *)col_data)[col_count-1], 16);
-		} else if (col_count) {
-			sreg_shift_col_bits(((uint16_t *)col_data)[col_count-1], 16);
-		} else if (row_count) {
-			sreg_shift_both_bits(((uint16_t *)row_data)[row_count-1], 16, 0, 0);
-		}
+	memcpy(shift_rows, p->rows, sizeof(shift_rows));
+	memcpy(shift_cols, p->cols, sizeof(shift_cols));
+	shift_valid = 1;
 
-		if (row_count) {
-			row_count--;
-		}
+	return wave_shift(op, p->rows, row_count, p->cols, col_count);
+}
+
+// Compile pulses from first until the program is full.
+// Pulse n+1 is shifted in while pulse n flips.
+// Returns the next pulse to compile, the program length in *len.
+static uint_fast16_t
+wave_compile(const struct pulse *p, uint_fast16_t first, uint_fast16_t count, size_t *len)
+{
+	struct wave_op *op = wave;
+	uint_fast16_t i;
+
+	if (first == 0) {
+		op = wave_load(op, &p[0]);
+	}
+
+	for (i = first; i < count && (op - wave) + WAVE_PULSE_OPS <= WAVE_MAX; i++) {
+		op->type = WAVE_STROBE;
+		op->delay = WAVE_DELAY(STROBE_DELAY);
+		op++;
 
-		if (col_count) {
-			col_count--;
+		op->type = WAVE_PULSE_START;
+		op->oe = p[i].oe;
+		op++;
+
+		if (i + 1 < count) {
+			op = wave_load(op, &p[i+1]);
 		}
+
+		op->type = WAVE_PULSE_END;
+		op++;
 	}
-}
 
+	*len = op - wave;
+	return i;
+}
 
-// TODO: protect OE pulse against long delay
+// Wait between shift edges. nanosleep() can take far longer than the
+// few ns asked for, so during a pulse the wait spins and the pulse is
+// ended on time.
 static void
-flip_to_0(void)
+wave_sleep(long nsec)
 {
-	_hw_clr(OE1);
+	uint64_t until;
 
-	_microsleep(OE_DELAY);
+	if (!pulse_active) {
+		_nanosleep(nsec);
+		return;
+	}
 
-	_hw_set(OE0);
+	until = _now() + nsec;
 
-	_microsleep(FLIP_DELAY);
+	if (until >= pulse_end) {
+		_sleep_until(pulse_end);
+		flip_end();
+	}
 
-	_hw_clr(OE0);
+	_sleep_until(until);
 }
 
 static void
-flip_to_1(void)
+wave_play(const struct wave_op *op, size_t len)
 {
-	_hw_clr(OE0);
+	// start of the current run of shift writes
+	uint64_t shift_start = 0;
+	uint_fast8_t shifting = 0;
+
+	for (size_t i = 0; i < len; i++, op++) {
+		if (PHASES && shifting && op->type != WAVE_WRITE) {
+			phase_add(FLIPDOT_PHASE_SHIFT, 1, shift_start, phase_time());
+			shifting = 0;
+		}
+
+		switch (op->type) {
+			case WAVE_WRITE:
+				if (PHASES && !shifting) {
+					shift_start = phase_time();
+					shifting = 1;
+				}
+
+				// a write can be a syscall, check the pulse before every one
+				flip_poll();
+
+				if (op->clr | op->set) {
+					hw->write(op->clr, op->set);
+				}
+
+				if (op->delay) {
+					wave_sleep(op->delay);
+				}
+				break;
+
+			case WAVE_STROBE: {
+				uint64_t start = phase_time();
+
+				_hw_set(STROBE);
+				if (op->delay) {
+					_nanosleep(op->delay);
+				}
+				_hw_clr(STROBE);
 
-	_microsleep(OE_DELAY);
+				phase_add(FLIPDOT_PHASE_STROBE, 1, start, phase_time());
+				break;
+			}
 
-	_hw_set(OE1);
+			case WAVE_PULSE_START:
+				flip_start(op->oe);
+				break;
 
-	_microsleep(FLIP_DELAY);
+			case WAVE_PULSE_END:
+				flip_finish();
+				break;
+		}
+	}
 
-	_hw_clr(OE1);
+	if (PHASES && shifting) {
+		phase_add(FLIPDOT_PHASE_SHIFT, 1, shift_start, phase_time());
+	}
 }
 
+// Shift, strobe and flip a list of pulses
+static void
+run_pulses(const struct pulse *p, uint_fast16_t count)
+{
+	uint_fast16_t i = 0;
+	size_t len;
+
+	while (i < count) {
+		i = wave_compile(p, i, count, &len);
+		wave_play(wave, len);
+	}
+}
+
+
+uint64_t
+flipdot_now(void)
+{
+	return _now();
+}
 
 void
+flipdot_set_hw(const struct flipdot_hw *new_hw)
+{
+	hw = new_hw;
+}
+
+int
 flipdot_init(void)
 {
-	_hw_init();
+	if (!hw->init()) {
+		return 0;
+	}
+
+	oe_off[0] = oe_off[1] = _now();
+
+	wave_init();
+	shift_valid = 0;
 
 	frame_old = &frames[0];
 	memset(frame_old, 0x00, sizeof(*frame_old));
 
 	frame_new = &frames[1];
 	memset(frame_new, 0x00, sizeof(*frame_new));
+
+	refresh_row = 0;
+
+	return 1;
+}
+
+void
+flipdot_get_phase_stats(struct flipdot_phase_stats *stats)
+{
+	const struct flipdot_phase_stats *src = phase_stats;
+	uint32_t seq;
+
+	do {
+		seq = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+		memcpy(stats, src, sizeof(*stats));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || seq != __atomic_load_n(&src->seq, __ATOMIC_RELAXED));
+}
+
+void
+flipdot_reset_phase_stats(void)
+{
+	struct flipdot_phase_stats *stats = phase_stats;
+
+	__atomic_store_n(&stats->seq, stats->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	memset(stats->phase, 0, sizeof(stats->phase));
+
+	__atomic_store_n(&stats->seq, stats->seq + 1, __ATOMIC_RELEASE);
+}
+
+// Move the counters to a POSIX shared memory object, e.g. FLIPDOT_PHASE_SHM.
+// Returns 0 if it cannot be mapped or PHASE_STATS is 0.
+int
+flipdot_phase_stats_shm(const char *name)
+{
+#if PHASE_STATS
+	struct flipdot_phase_stats *shm;
+	int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+
+	if (fd == -1) {
+		return 0;
+	}
+
+	if (ftruncate(fd, sizeof(*shm)) == -1) {
+		close(fd);
+		return 0;
+	}
+
+	shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (shm == MAP_FAILED) {
+		return 0;
+	}
+
+	flipdot_get_phase_stats(shm);
+	shm->seq = 0;
+
+	if (phase_stats != &phase_local) {
+		munmap(phase_stats, sizeof(*phase_stats));
+	}
+	phase_stats = shm;
+
+	return 1;
+#else
+	(void)name;
+	return 0;
+#endif
+}
+
+// Returns the total number of flips
+uint64_t
+flipdot_get_wear(flipdot_wear_t *wear)
+{
+#if WEAR_STATS
+	for (uint_fast16_t y = 0; y < DISP_ROWS; y++) {
+		for (uint_fast16_t x = 0; x < DISP_COLS; x++) {
+			uint_fast16_t i = frame_pixel(x, y);
+			uint32_t count = wear_counts[i];
+
+			// flips still in the planes
+			for (uint_fast8_t n = 0; n < WEAR_PLANES; n++) {
+				count += ((wear_planes[n][i / 64] >> wear_bit(i)) & 1) << n;
+			}
+
+			(*wear)[(y * DISP_COLS) + x] = count;
+		}
+	}
+
+	return wear_total;
+#else
+	memset(wear, 0, sizeof(*wear));
+	return 0;
+#endif
+}
+
+// Continue counting from wear, e.g. a snapshot saved before a restart
+void
+flipdot_set_wear(const uint32_t *wear)
+{
+#if WEAR_STATS
+	flipdot_reset_wear();
+
+	for (uint_fast16_t y = 0; y < DISP_ROWS; y++) {
+		for (uint_fast16_t x = 0; x < DISP_COLS; x++) {
+			uint32_t count = wear[(y * DISP_COLS) + x];
+
+			wear_counts[frame_pixel(x, y)] = count;
+			wear_total += count;
+		}
+	}
+#else
+	(void)wear;
+#endif
+}
+
+void
+flipdot_reset_wear(void)
+{
+#if WEAR_STATS
+	memset(wear_planes, 0, sizeof(wear_planes));
+	memset(wear_counts, 0, sizeof(wear_counts));
+	wear_pending = 0;
+	wear_total = 0;
+#endif
+}
+
+void
+flipdot_get_timing_stats(struct flipdot_timing_stats *stats)
+{
+	*stats = timing_stats;
+}
+
+void
+flipdot_reset_timing_stats(void)
+{
+	memset(&timing_stats, 0, sizeof(timing_stats));
 }
 
 void
 flipdot_shutdown(void)
 {
-	_hw_shutdown();
+	hw->shutdown();
 }
 
 void
@@ -399,54 +940,66 @@ flipdot_clear(void)
 void
 flipdot_display_row(const uint8_t *rows, const uint8_t *cols)
 {
-	sreg_fill_both(rows, REGISTER_ROWS, cols, REGISTER_COLS);
-	sreg_strobe();
-	flip_to_0();
-	flip_to_1();
+	memcpy(pulses[0].rows, rows, sizeof(pulses[0].rows));
+	memcpy(pulses[0].cols, cols, sizeof(pulses[0].cols));
+	pulses[0].oe = 0;
+
+	pulses[1] = pulses[0];
+	pulses[1].oe = 1;
+
+	run_pulses(pulses, 2);
 }
 
 void
 flipdot_display_row_single(const uint8_t *rows, const uint8_t *cols, uint8_t oe)
 {
-	sreg_fill_both(rows, REGISTER_ROWS, cols, REGISTER_COLS);
-	sreg_strobe();
+	memcpy(pulses[0].rows, rows, sizeof(pulses[0].rows));
+	memcpy(pulses[0].cols, cols, sizeof(pulses[0].cols));
+	pulses[0].oe = oe;
 
-	if (oe == 0) {
-		flip_to_0();
-	} else {
-		flip_to_1();
-	}
+	run_pulses(pulses, 1);
 }
 
 void
 flipdot_display_row_diff(const uint8_t *rows, const uint8_t *cols_to_0, const uint8_t *cols_to_1)
 {
-	sreg_fill_both(rows, REGISTER_ROWS, cols_to_0, REGISTER_COLS);
-	sreg_strobe();
-	flip_to_0();
+	memcpy(pulses[0].rows, rows, sizeof(pulses[0].rows));
+	memcpy(pulses[0].cols, cols_to_0, sizeof(pulses[0].cols));
+	pulses[0].oe = 0;
 
-	sreg_fill_col(cols_to_1, REGISTER_COLS);
-	sreg_strobe();
-	flip_to_1();
+	memcpy(pulses[1].rows, rows, sizeof(pulses[1].rows));
+	memcpy(pulses[1].cols, cols_to_1, sizeof(pulses[1].cols));
+	pulses[1].oe = 1;
+
+	run_pulses(pulses, 2);
 }
 
 void
 flipdot_display_frame(const uint8_t *frame)
 {
-	uint8_t rows[REGISTER_ROW_BYTE_COUNT];
-	uint8_t *frameptr;
+	struct pulse *p = pulses;
+	uint64_t start = phase_time();
 
+	wear_add(*frame_new, frame, 0, FRAME_BYTE_COUNT);
 	memcpy(frame_new, frame, sizeof(*frame_new));
-	frameptr = (uint8_t *)frame_new;
 
-	for (uint_fast16_t row = 0; row < REGISTER_ROWS; row++) {
-		memset(rows, 0, sizeof(rows));
-		SETBIT(rows, row);
+	// flip all rows to 0, then all rows to 1
+	for (uint8_t oe = 0; oe < 2; oe++) {
+		uint8_t *frameptr = (uint8_t *)frame_new;
 
-		flipdot_display_row(rows, frameptr);
+		for (uint_fast16_t row = 0; row < REGISTER_ROWS; row++) {
+			memset(p->rows, 0, sizeof(p->rows));
+			SETBIT(p->rows, row);
+			memcpy(p->cols, frameptr, sizeof(p->cols));
+			p->oe = oe;
 
-		frameptr += REGISTER_COL_BYTE_COUNT;
+			p++;
+			frameptr += REGISTER_COL_BYTE_COUNT;
+		}
 	}
+
+	run_pulses(pulses, p - pulses);
+	phase_add(FLIPDOT_PHASE_FRAME, 1, start, phase_time());
 }
 
 void
@@ -458,62 +1011,283 @@ flipdot_display_bitmap(const uint8_t *bitmap)
 	flipdot_display_frame(frame);
 }
 
-void
-flipdot_update_frame(const uint8_t *frame)
+// Rows of flipdot_refresh() that fit into budget (ns), modeled like
+// flipdot_estimate_update(): the first pulse is loaded in full, the other
+// ones while the previous pulse flips, OE_DELAY once between 0 and 1.
+static uint_fast16_t
+refresh_rows(uint64_t budget)
 {
-	uint8_t rows[REGISTER_ROW_BYTE_COUNT];
-	uint8_t cols_to_0[REGISTER_COL_BYTE_COUNT];
-	uint8_t cols_to_1[REGISTER_COL_BYTE_COUNT];
-	uint8_t *frameptr_old;
-	uint8_t *frameptr_new;
-	uint_fast8_t row_changed_to_0;
-	uint_fast8_t row_changed_to_1;
+	uint64_t load = (uint64_t)((REGISTER_ROWS > CHAIN_COLS) ? REGISTER_ROWS : CHAIN_COLS) * CLOCK_TIME;
+	uint64_t pulse = STROBE_DELAY + (((FLIP_DELAY * 1000) > load) ? (FLIP_DELAY * 1000) : load);
+	uint64_t fixed = load + (OE_DELAY * 1000);
+	uint64_t rows;
 
-	flipdot_frame_t *tmp = frame_old;
-	frame_old = frame_new;
-	frame_new = tmp;
+	if (budget <= fixed) {
+		return 0;
+	}
 
-	memcpy(frame_new, frame, sizeof(*frame_new));
+	rows = (budget - fixed) / (2 * pulse);
 
-	frameptr_old = (uint8_t *)frame_old;
-	frameptr_new = (uint8_t *)frame_new;
+	return (rows > REGISTER_ROWS) ? REGISTER_ROWS : rows;
+}
 
-	for (uint_fast16_t row = 0; row < REGISTER_ROWS; row++) {
-		row_changed_to_0 = 0;
-		row_changed_to_1 = 0;
+// Pulse the next rows of the frame on the display once more, to 0 and
+// to 1 like flipdot_display_frame(), as many as fit into budget (ns).
+// Dots that are stuck or were knocked over return to their position,
+// the others do not move. Successive calls cycle through all rows.
+// Returns the number of rows refreshed.
+int
+flipdot_refresh(uint64_t budget)
+{
+	struct pulse *p = pulses;
+	uint_fast16_t rows = refresh_rows(budget);
 
-		for (uint_fast16_t col = 0; col < REGISTER_COL_BYTE_COUNT; col++) {
-			uint8_t old = *frameptr_old;
-			uint8_t new = *frameptr_new;
+	if (rows == 0) {
+		return 0;
+	}
+
+	for (uint8_t oe = 0; oe < 2; oe++) {
+		for (uint_fast16_t n = 0; n < rows; n++) {
+			uint_fast16_t row = (refresh_row + n) % REGISTER_ROWS;
+
+			memset(p->rows, 0, sizeof(p->rows));
+			SETBIT(p->rows, row);
+			memcpy(p->cols, *frame_new + (row * REGISTER_COL_BYTE_COUNT), sizeof(p->cols));
+			p->oe = oe;
+
+			p++;
+		}
+	}
+
+	run_pulses(pulses, p - pulses);
+	refresh_row = (refresh_row + rows) % REGISTER_ROWS;
+
+	return rows;
+}
+
+// Rows row to row_end - 1 and column bytes byte to byte_end - 1 of the
+// frame, the part an update may change
+struct window {
+	uint_fast16_t row, row_end;
+	uint_fast16_t byte, byte_end;
+};
+
+static const struct window full_window = { 0, REGISTER_ROWS, 0, REGISTER_COL_BYTE_COUNT };
+
+// Group lines (rows or columns) with identical flip patterns.
+// lines holds lines of size bytes, bits set for pixels to flip. Only
+// lines first to end - 1 and bytes byte to byte + bytes - 1 of each line
+// are looked at, the other bytes must be 0.
+// group[i] receives the index of the first line with the same pattern,
+// or NO_GROUP if line i does not change.
+// Returns the number of groups, one pulse each.
+static uint_fast16_t
+plan_groups(const uint8_t *lines, uint_fast16_t size, uint_fast16_t first, uint_fast16_t end,
+	uint_fast16_t byte, uint_fast16_t bytes, uint_fast16_t *group)
+{
+	uint_fast16_t groups = 0;
+
+	for (uint_fast16_t i = first; i < end; i++) {
+		const uint8_t *line = lines + (i * size) + byte;
+		uint8_t changed = 0;
 
-			cols_to_0[col] = ~((old) & ~(new));
-			cols_to_1[col] = (~(old) & (new));
+		for (uint_fast16_t j = 0; j < bytes; j++) {
+			changed |= line[j];
+		}
+
+		if (!changed) {
+			group[i] = NO_GROUP;
+			continue;
+		}
+
+		group[i] = i;
 
-			if (cols_to_0[col] != 0xFF) {
-				row_changed_to_0 = 1;
+		for (uint_fast16_t k = first; k < i; k++) {
+			if (group[k] == k && memcmp(lines + (k * size) + byte, line, bytes) == 0) {
+				group[i] = k;
+				break;
 			}
+		}
 
-			if (cols_to_1[col] != 0x00) {
-				row_changed_to_1 = 1;
+		if (group[i] == i) {
+			groups++;
+		}
+	}
+
+	return groups;
+}
+
+// Row-major scan: select all rows of a group, flip their columns
+static uint_fast16_t
+plan_rows(struct pulse *p, const uint8_t *to, uint8_t oe, const uint_fast16_t *group, const struct window *win)
+{
+	struct pulse *start = p;
+
+	for (uint_fast16_t row = win->row; row < win->row_end; row++) {
+		if (group[row] != row) {
+			continue;
+		}
+
+		memset(p->rows, 0, sizeof(p->rows));
+		for (uint_fast16_t other = row; other < win->row_end; other++) {
+			if (group[other] == row) {
+				SETBIT(p->rows, other);
 			}
+		}
 
-			frameptr_old++;
-			frameptr_new++;
+		// a 0-bit in the column register selects a pixel to flip to 0
+		for (uint_fast16_t col = 0; col < REGISTER_COL_BYTE_COUNT; col++) {
+			uint8_t cols = (col >= win->byte && col < win->byte_end) ? to[(row * REGISTER_COL_BYTE_COUNT) + col] : 0;
+			p->cols[col] = (oe == 0) ? ~cols : cols;
 		}
 
-		if (row_changed_to_0 || row_changed_to_1) {
-			memset(rows, 0, sizeof(rows));
-			SETBIT(rows, row);
+		p->oe = oe;
+		p++;
+	}
+
+	return p - start;
+}
 
-			if (row_changed_to_0 && row_changed_to_1) {
-				flipdot_display_row_diff(rows, cols_to_0, cols_to_1);
-			} else if (row_changed_to_0) {
-				flipdot_display_row_single(rows, cols_to_0, 0);
-			} else {
-				flipdot_display_row_single(rows, cols_to_1, 1);
+// Column-major scan: select all columns of a group, flip their rows
+static uint_fast16_t
+plan_cols(struct pulse *p, const uint8_t *to, uint8_t oe, const uint_fast16_t *group, const struct window *win)
+{
+	struct pulse *start = p;
+	flipdot_col_reg_t cols;
+
+	for (uint_fast16_t col = win->byte * 8; col < win->byte_end * 8; col++) {
+		if (group[col] != col) {
+			continue;
+		}
+
+		memset(cols, 0, sizeof(cols));
+		for (uint_fast16_t other = col; other < win->byte_end * 8; other++) {
+			if (group[other] == col) {
+				SETBIT(cols, other);
+			}
+		}
+
+		memcpy(p->rows, to + (col * REGISTER_ROW_BYTE_COUNT), sizeof(p->rows));
+		for (uint_fast16_t i = 0; i < REGISTER_COL_BYTE_COUNT; i++) {
+			p->cols[i] = (oe == 0) ? ~cols[i] : cols[i];
+		}
+
+		p->oe = oe;
+		p++;
+	}
+
+	return p - start;
+}
+
+// Plan the pulses to flip from frame old to frame new, which only differ
+// within win.
+// All pulses to 0 come first, followed by all pulses to 1, so OE_DELAY
+// is needed only once per frame. Each polarity uses the row-major or
+// column-major scan, whichever needs fewer pulses.
+static uint_fast16_t
+plan_frame(struct pulse *p, const uint8_t *old, const uint8_t *new, const struct window *win)
+{
+	// pixels to flip, indexed by row
+	uint8_t rows_to[2][REGISTER_ROWS][REGISTER_COL_BYTE_COUNT];
+	uint_fast16_t row_group[REGISTER_ROWS];
+
+	// pixels to flip, indexed by column
+	uint8_t cols_to[2][REGISTER_COLS][REGISTER_ROW_BYTE_COUNT];
+	uint_fast16_t col_group[REGISTER_COLS];
+
+	uint_fast16_t bytes = win->byte_end - win->byte;
+	uint_fast16_t count = 0;
+
+	memset(cols_to[0][win->byte * 8], 0, bytes * 8 * REGISTER_ROW_BYTE_COUNT);
+	memset(cols_to[1][win->byte * 8], 0, bytes * 8 * REGISTER_ROW_BYTE_COUNT);
+
+	for (uint_fast16_t row = win->row; row < win->row_end; row++) {
+		const uint8_t *from = old + (row * REGISTER_COL_BYTE_COUNT);
+		const uint8_t *to = new + (row * REGISTER_COL_BYTE_COUNT);
+
+		for (uint_fast16_t col = win->byte; col < win->byte_end; col++) {
+			rows_to[0][row][col] = (from[col] & ~to[col]);
+			rows_to[1][row][col] = (~from[col] & to[col]);
+
+			// transpose changed pixels for the column-major scan
+			if (from[col] != to[col]) {
+				for (uint_fast8_t bit = 0; bit < 8; bit++) {
+					if (rows_to[0][row][col] & _BV(bit)) {
+						SETBIT(cols_to[0][(col * 8) + bit], row);
+					} else if (rows_to[1][row][col] & _BV(bit)) {
+						SETBIT(cols_to[1][(col * 8) + bit], row);
+					}
+				}
 			}
 		}
 	}
+
+	for (uint8_t oe = 0; oe < 2; oe++) {
+		uint_fast16_t row_pulses = plan_groups((uint8_t *)rows_to[oe], REGISTER_COL_BYTE_COUNT,
+			win->row, win->row_end, win->byte, bytes, row_group);
+		uint_fast16_t col_pulses = plan_groups((uint8_t *)cols_to[oe], REGISTER_ROW_BYTE_COUNT,
+			win->byte * 8, win->byte_end * 8, 0, REGISTER_ROW_BYTE_COUNT, col_group);
+
+		if (col_pulses < row_pulses) {
+			count += plan_cols(p + count, (uint8_t *)cols_to[oe], oe, col_group, win);
+		} else {
+			count += plan_rows(p + count, (uint8_t *)rows_to[oe], oe, row_group, win);
+		}
+	}
+
+	return count;
+}
+
+// Swap in the new frame and plan the pulses, returns the pulse count
+static uint_fast16_t
+update_frame(const uint8_t *frame)
+{
+	flipdot_frame_t *tmp = frame_old;
+	uint_fast16_t count;
+	uint64_t start;
+
+	frame_old = frame_new;
+	frame_new = tmp;
+
+	memcpy(frame_new, frame, sizeof(*frame_new));
+
+	start = phase_time();
+	count = plan_frame(pulses, *frame_old, *frame_new, &full_window);
+	wear_add(*frame_old, *frame_new, 0, FRAME_BYTE_COUNT);
+
+	phase_add(FLIPDOT_PHASE_DIFF, 1, start, phase_time());
+
+	return count;
+}
+
+void
+flipdot_update_frame(const uint8_t *frame)
+{
+	uint64_t start = phase_time();
+
+	run_pulses(pulses, update_frame(frame));
+	phase_add(FLIPDOT_PHASE_FRAME, 1, start, phase_time());
+}
+
+// Planning and loading the first pulse happen before the deadline,
+// the first OE pulse starts at it
+int64_t
+flipdot_update_frame_at(const uint8_t *frame, uint64_t start)
+{
+	uint64_t begin = phase_time();
+	uint_fast16_t count = update_frame(frame);
+
+	if (count == 0) {
+		_sleep_until(start);
+		phase_add(FLIPDOT_PHASE_FRAME, 1, begin, phase_time());
+		return _now() - start;
+	}
+
+	start_at = start;
+	run_pulses(pulses, count);
+	phase_add(FLIPDOT_PHASE_FRAME, 1, begin, phase_time());
+
+	return start_error;
 }
 
 void
@@ -525,27 +1299,206 @@ flipdot_update_bitmap(const uint8_t *bitmap)
 	flipdot_update_frame(frame);
 }
 
-// Slow bit copy
+// Merge the rectangle into the frame on the display and flip what changed.
+// Only the rows and column bytes of the rectangle are diffed, frame_old
+// receives just its rows.
+void
+flipdot_update_rect(uint16_t x, uint16_t y, uint16_t width, uint16_t height, const uint8_t *bitmap)
+{
+	uint64_t start = phase_time();
+	uint64_t diff;
+	uint_fast16_t w, h, first, end, count;
+	struct window win;
+
+	if (x >= DISP_COLS || y >= DISP_ROWS || width == 0 || height == 0) {
+		return;
+	}
+
+	w = (width > DISP_COLS - x) ? (DISP_COLS - x) : width;
+	h = (height > DISP_ROWS - y) ? (DISP_ROWS - y) : height;
+
+	win.row = y;
+	win.row_end = y + h;
+	win.byte = frame_pixel(x, 0) / 8;
+	win.byte_end = (frame_pixel(x + w - 1, 0) / 8) + 1;
+
+	first = win.row * REGISTER_COL_BYTE_COUNT;
+	end = win.row_end * REGISTER_COL_BYTE_COUNT;
+	memcpy(*frame_old + first, *frame_new + first, end - first);
+
+	for (uint_fast16_t j = 0; j < h; j++) {
+		for (uint_fast16_t i = 0; i < w; i++) {
+			uint_fast16_t pixel = frame_pixel(x + i, y + j);
+
+			if (ISBITSET(bitmap, ((size_t)j * width) + i)) {
+				SETBIT(*frame_new, pixel);
+			} else {
+				CLRBIT(*frame_new, pixel);
+			}
+		}
+	}
+
+	diff = phase_time();
+	count = plan_frame(pulses, *frame_old, *frame_new, &win);
+	wear_add(*frame_old, *frame_new, first, end);
+	phase_add(FLIPDOT_PHASE_DIFF, 1, diff, phase_time());
+
+	run_pulses(pulses, count);
+	phase_add(FLIPDOT_PHASE_FRAME, 1, start, phase_time());
+}
+
+void
+flipdot_get_frame(flipdot_frame_t *frame)
+{
+	memcpy(frame, frame_new, sizeof(*frame));
+}
+
+// Model of run_pulses(): the first pulse is loaded in full, every other
+// one while the previous pulse flips, so a pulse takes FLIP_DELAY or the
+// time to shift the next one, whichever is longer. The OE_DELAY dead
+// time comes once between the pulses to 0 and to 1.
+void
+flipdot_estimate_update(const uint8_t *old, const uint8_t *new, struct flipdot_cost *cost)
+{
+	struct pulse p[PULSE_MAX];
+	uint_fast16_t count = plan_frame(p, old, new, &full_window);
+	uint_fast16_t load = (REGISTER_ROWS > CHAIN_COLS) ? REGISTER_ROWS : CHAIN_COLS;
+
+	cost->pixels = 0;
+	for (uint_fast16_t i = 0; i < FRAME_BYTE_COUNT; i++) {
+		cost->pixels += __builtin_popcount(old[i] ^ new[i]);
+	}
+
+	cost->pulses = count;
+	cost->clocks = 0;
+	cost->duration = 0;
+
+	if (count == 0) {
+		return;
+	}
+
+	cost->clocks = load;
+	cost->duration = (uint64_t)load * CLOCK_TIME;
+
+	for (uint_fast16_t i = 0; i < count; i++) {
+		uint64_t pulse = FLIP_DELAY * 1000;
+
+		if (i + 1 < count) {
+			uint_fast16_t rows = shift_count(p[i].rows, p[i+1].rows, REGISTER_ROW_BYTE_COUNT, REGISTER_ROWS, 1);
+			uint_fast16_t cols = shift_count(p[i].cols, p[i+1].cols, CHAIN_COL_BYTE_COUNT, CHAIN_COLS, CHAIN_COUNT);
+
+			load = (rows > cols) ? rows : cols;
+			cost->clocks += load;
+
+			if ((uint64_t)load * CLOCK_TIME > pulse) {
+				pulse = (uint64_t)load * CLOCK_TIME;
+			}
+		}
+
+		if (i > 0 && p[i].oe != p[i-1].oe) {
+			cost->duration += OE_DELAY * 1000;
+		}
+
+		cost->duration += STROBE_DELAY + pulse;
+	}
+}
+
+// Bitmap rows are packed, frame rows have COL_GAP blind bits after
+// every module. Each module row starts on a frame byte boundary, so the
+// conversion streams MODULE_COLS bits per module row through a 64 bit
+// accumulator on the bitmap side, 32 bits at a time.
+
+static inline uint32_t
+load_le(const uint8_t *p, uint_fast8_t bytes)
+{
+	uint32_t v = 0;
+
+	for (uint_fast8_t i = 0; i < bytes; i++) {
+		v |= (uint32_t)p[i] << (i * 8);
+	}
+
+	return v;
+}
+
+static inline void
+store_le(uint8_t *p, uint32_t v, uint_fast8_t bytes)
+{
+	for (uint_fast8_t i = 0; i < bytes; i++) {
+		p[i] = v >> (i * 8);
+	}
+}
+
 void
 flipdot_bitmap_to_frame(const uint8_t *bitmap, flipdot_frame_t *frame)
 {
-	memset(frame, 0x00, sizeof(*frame));
+	const uint8_t *src = bitmap;
+	const uint8_t *src_end = bitmap + DISP_BYTE_COUNT;
+	uint8_t *dst = *frame;
+	uint64_t acc = 0;
+	uint_fast8_t acc_len = 0;
+
+	for (uint_fast16_t seg = 0; seg < DISP_ROWS * MODULE_COUNT_H; seg++) {
+		uint8_t *seg_end = dst + MODULE_REGISTER_BYTE_COUNT;
+
+		for (uint_fast16_t bits = 0; bits < MODULE_COLS; bits += 32) {
+			uint_fast8_t n = (MODULE_COLS - bits < 32) ? (MODULE_COLS - bits) : 32;
+
+			if (acc_len < n) {
+				if (src_end - src >= 4) {
+					acc |= (uint64_t)load_le(src, 4) << acc_len;
+					acc_len += 32;
+					src += 4;
+				} else {
+					while (acc_len < n && src < src_end) {
+						acc |= (uint64_t)*src++ << acc_len;
+						acc_len += 8;
+					}
+				}
+			}
+
+			store_le(dst, acc & ((1ULL << n) - 1), (n + 7) / 8);
+			dst += (n + 7) / 8;
 
-	for (uint_fast16_t i = 0; i < DISP_PIXEL_COUNT; i++) {
-		if (ISBITSET(bitmap, i)) {
-			SETBIT(frame, i + ((i / MODULE_COLS) * COL_GAP));
+			acc >>= n;
+			acc_len -= n;
 		}
+
+		// blind gap
+		memset(dst, 0x00, seg_end - dst);
+		dst = seg_end;
 	}
 }
 
 void
 flipdot_frame_to_bitmap(const uint8_t *frame, flipdot_bitmap_t *bitmap)
 {
-	memset(bitmap, 0x00, sizeof(*bitmap));
+	uint8_t *dst = *bitmap;
+	uint64_t acc = 0;
+	uint_fast8_t acc_len = 0;
+
+	for (uint_fast16_t seg = 0; seg < DISP_ROWS * MODULE_COUNT_H; seg++) {
+		const uint8_t *src = frame + (seg * MODULE_REGISTER_BYTE_COUNT);
+
+		for (uint_fast16_t bits = 0; bits < MODULE_COLS; bits += 32) {
+			uint_fast8_t n = (MODULE_COLS - bits < 32) ? (MODULE_COLS - bits) : 32;
 
-	for (uint_fast16_t i = 0; i < DISP_PIXEL_COUNT; i++) {
-		if (ISBITSET(frame, i + ((i / MODULE_COLS) * COL_GAP))) {
-			SETBIT(bitmap, i);
+			acc |= (uint64_t)(load_le(src + (bits / 8), (n + 7) / 8) & ((1ULL << n) - 1)) << acc_len;
+			acc_len += n;
+
+			if (acc_len >= 32) {
+				store_le(dst, acc, 4);
+				dst += 4;
+
+				acc >>= 32;
+				acc_len -= 32;
+			}
 		}
 	}
+
+	while (acc_len > 0) {
+		*dst++ = acc;
+
+		acc >>= 8;
+		acc_len = (acc_len > 8) ? (acc_len - 8) : 0;
+	}
 }
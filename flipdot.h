@@ -1,6 +1,7 @@
 #ifndef FLIPDOT_H
 #define FLIPDOT_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 
@@ -19,10 +20,24 @@
 #define OE0 24
 #define OE1 10
 
+// Parallel chains
+// The modules of each row can be split into CHAIN_COUNT chains of
+// MODULE_COUNT_H / CHAIN_COUNT modules, chain 0 starting at column 0.
+// Chains share ROW_CLK, COL_CLK, STROBE and OE, every chain has its own
+// row and column data GPIO. List one GPIO per chain, chain 0 first,
+// e.g. "ROW_DATA, 5" and "COL_DATA, 6" for two chains.
+#define CHAIN_COUNT 1
+#define CHAIN_ROW_DATA ROW_DATA
+#define CHAIN_COL_DATA COL_DATA
+
+// GPIO character device for the gpiochip backend
+#define GPIOCHIP_DEV "/dev/gpiochip0"
+
 
 // Timing parameters
 // nanosleep is only roughly accurate
-// delays can be much longer
+// shift register delays can be much longer,
+// OE_DELAY and FLIP_DELAY end with a busy wait
 
 // shift register set-up time (ns)
 #define DATA_DELAY 15
@@ -37,6 +52,34 @@
 // flip motor pulse width (us)
 #define FLIP_DELAY 500
 
+// busy wait before the end of OE_DELAY and FLIP_DELAY (us)
+#define SPIN_DELAY 150
+
+// estimated time of one shift register clock including the GPIO writes (ns),
+// only used for flipdot_estimate_update()
+#define CLOCK_TIME 200
+
+
+// Background refresh
+// flipnetd calls flipdot_refresh() with a budget of REFRESH_BUDGET (us)
+// after REFRESH_IDLE (ms) without a frame, REFRESH_IDLE 0 turns it off.
+// The output thread only refreshes after flipdot_async_set_refresh().
+#define REFRESH_IDLE 1000
+#define REFRESH_BUDGET 5000
+
+
+// Instrumentation
+
+// per-phase counters of flipdot_get_phase_stats(), 0 compiles them out
+#define PHASE_STATS 1
+
+// USDT tracepoint flipdot:phase(id, count, start, end) for perf or bpftrace,
+// needs <sys/sdt.h> (systemtap-sdt-dev)
+#define PHASE_TRACE 0
+
+// per-pixel flip counters of flipdot_get_wear(), 0 compiles them out
+#define WEAR_STATS 1
+
 
 // Display geometry
 
@@ -57,6 +100,12 @@
 #define REGISTER_COL_BYTE_COUNT ((REGISTER_COLS + 7) / 8)
 #define REGISTER_ROW_BYTE_COUNT ((REGISTER_ROWS + 7) / 8)
 
+// frame bytes per module row, every module row starts on a byte boundary
+#define MODULE_REGISTER_BYTE_COUNT ((MODULE_COLS + COL_GAP) / 8)
+
+#define CHAIN_COLS (REGISTER_COLS / CHAIN_COUNT)
+#define CHAIN_COL_BYTE_COUNT (CHAIN_COLS / 8)
+
 #define DISP_COLS (MODULE_COUNT_H * MODULE_COLS)
 #define DISP_ROWS (MODULE_COUNT_V * MODULE_ROWS)
 
@@ -67,6 +116,10 @@
 #define FRAME_BYTE_COUNT ((FRAME_PIXEL_COUNT + 7) / 8)
 
 
+#if (MODULE_COUNT_H % CHAIN_COUNT)
+#error "unsupported chain count: MODULE_COUNT_H must be a multiple of CHAIN_COUNT"
+#endif
+
 #if (REGISTER_COLS > INT_FAST16_MAX)
 #error "unsupported display size: REGISTER_COLS too large for int_fast16_t"
 #endif
@@ -87,7 +140,11 @@ typedef uint8_t flipdot_col_reg_t[REGISTER_COL_BYTE_COUNT];
 typedef uint8_t flipdot_row_reg_t[REGISTER_ROW_BYTE_COUNT];
 
 
-void flipdot_init(void);
+struct flipdot_hw;
+
+void flipdot_set_hw(const struct flipdot_hw *hw);
+
+int flipdot_init(void);
 void flipdot_shutdown(void);
 
 void flipdot_clear_to_0(void);
@@ -105,8 +162,171 @@ void flipdot_display_bitmap(const uint8_t *bitmap);
 void flipdot_update_frame(const uint8_t *frame);
 void flipdot_update_bitmap(const uint8_t *bitmap);
 
+// merge a width x height bitmap (pixel (x, y) is bit y * width + x, LSB
+// first) into the frame at x, y and flip the changed dots
+void flipdot_update_rect(uint16_t x, uint16_t y, uint16_t width, uint16_t height, const uint8_t *bitmap);
+
+// start the first flip pulse at time start of flipdot_now(),
+// returns how late it actually started (ns)
+uint64_t flipdot_now(void);
+int64_t flipdot_update_frame_at(const uint8_t *frame, uint64_t start);
+
+// flipdot_update_rect(), flipdot_get_frame() and flipdot_refresh() use the
+// internal frame buffer without locking, call them only while the output
+// thread is stopped
+
+// frame on the display after the last update
+void flipdot_get_frame(flipdot_frame_t *frame);
+
+// pulse the next rows of the displayed frame again, within budget (ns)
+int flipdot_refresh(uint64_t budget);
+
 void flipdot_bitmap_to_frame(const uint8_t *bitmap, flipdot_frame_t *frame);
 void flipdot_frame_to_bitmap(const uint8_t *frame, flipdot_bitmap_t *bitmap);
 
+// XOR/RLE frame deltas, FRAME_BYTE_COUNT bytes at most
+size_t flipdot_delta_encode(uint8_t *delta, const uint8_t *frame, const uint8_t *prev);
+int flipdot_delta_apply(const uint8_t *delta, size_t len, flipdot_frame_t *frame);
+
+
+// Update cost model
+// flipdot_estimate_update() plans the update from frame old to frame new
+// without touching the display, the duration is modeled from the timing
+// parameters and CLOCK_TIME
+
+struct flipdot_cost {
+	uint32_t pixels;	// dots to flip
+	uint32_t pulses;	// OE pulses
+	uint32_t clocks;	// shift register clock cycles
+	uint64_t duration;	// ns
+};
+
+void flipdot_estimate_update(const uint8_t *old, const uint8_t *new, struct flipdot_cost *cost);
+
+
+// Frame rate governor
+// flipdot_governor_update_frame() keeps updates within the frame interval:
+// a frame is flipped fully if it fits, partially if only some rows fit,
+// or skipped while earlier updates still overrun. Rows left out are
+// flipped first by the next partial update.
+
+#define FLIPDOT_GOVERN_FULL 0
+#define FLIPDOT_GOVERN_PARTIAL 1
+#define FLIPDOT_GOVERN_SKIP 2
+
+struct flipdot_governor_stats {
+	uint32_t full;
+	uint32_t partial;
+	uint32_t skipped;
+	uint32_t scale;		// measured / estimated duration, 16.16 fixed point
+};
+
+void flipdot_governor_init(uint64_t interval);
+int flipdot_governor_update_frame(const uint8_t *frame);
+
+void flipdot_governor_get_stats(struct flipdot_governor_stats *stats);
+
+
+// Measured OE pulse widths
+// hist[0] counts pulses less than 1us longer than FLIP_DELAY,
+// hist[n] pulses 2^(n-1) to 2^n - 1 us longer
+
+#define FLIPDOT_TIMING_BINS 16
+
+struct flipdot_timing_stats {
+	uint32_t pulses;
+	uint64_t min_width;	// ns
+	uint64_t max_width;	// ns
+	uint64_t total_width;	// ns
+	uint32_t hist[FLIPDOT_TIMING_BINS];
+};
+
+void flipdot_get_timing_stats(struct flipdot_timing_stats *stats);
+void flipdot_reset_timing_stats(void);
+
+
+// Per-phase counters
+// count and total time (ns of flipdot_now()) of each phase of an update.
+// A shared memory copy can be polled by other processes, seq is odd
+// while the counters change.
+
+#define FLIPDOT_PHASE_DIFF 0		// plan_frame(), count updates
+#define FLIPDOT_PHASE_SHIFT 1		// shift register loading, count loads
+#define FLIPDOT_PHASE_STROBE 2		// latching the shift registers
+#define FLIPDOT_PHASE_OE_WAIT 3		// OE_DELAY dead time and start deadlines
+#define FLIPDOT_PHASE_FLIP_0 4		// OE0 pulses
+#define FLIPDOT_PHASE_FLIP_1 5		// OE1 pulses
+#define FLIPDOT_PHASE_FLIP_WAIT 6	// rest of FLIP_DELAY after shifting
+#define FLIPDOT_PHASE_FRAME 7		// whole frame updates
+#define FLIPDOT_PHASE_COUNT 8
+
+#define FLIPDOT_PHASE_SHM "/flipdot"
+
+struct flipdot_phase_stats {
+	uint32_t seq;
+	uint32_t size;		// sizeof(struct flipdot_phase_stats)
+	struct {
+		uint64_t count;
+		uint64_t time;	// ns
+	} phase[FLIPDOT_PHASE_COUNT];
+};
+
+void flipdot_get_phase_stats(struct flipdot_phase_stats *stats);
+void flipdot_reset_phase_stats(void);
+int flipdot_phase_stats_shm(const char *name);
+
+
+// Per-pixel flip counters
+// how often frame updates changed each dot, in bitmap order (y * DISP_COLS + x).
+// Not synchronized with the output thread, a read while it updates may
+// miss that update.
+//
+// snapshot, fields big endian:
+//  0  magic    "FDWR"
+//  4  version  FLIPDOT_WEAR_VERSION
+//  5  reserved 0
+//  6  DISP_COLS
+//  8  DISP_ROWS
+// 10  counts   one LEB128 varint per pixel, bitmap order
+
+#define FLIPDOT_WEAR_VERSION 1
+
+#define FLIPDOT_WEAR_HEADER_SIZE 10
+#define FLIPDOT_WEAR_SNAPSHOT_MAX (FLIPDOT_WEAR_HEADER_SIZE + (5 * DISP_PIXEL_COUNT))
+#define FLIPDOT_WEAR_PGM_MAX (32 + DISP_PIXEL_COUNT)
+
+typedef uint32_t flipdot_wear_t[DISP_PIXEL_COUNT];
+
+uint64_t flipdot_get_wear(flipdot_wear_t *wear);
+void flipdot_set_wear(const uint32_t *wear);
+void flipdot_reset_wear(void);
+
+size_t flipdot_wear_pgm(uint8_t *buf, const uint32_t *wear);
+size_t flipdot_wear_snapshot(uint8_t *buf, const uint32_t *wear);
+int flipdot_wear_load(const uint8_t *data, size_t size, flipdot_wear_t *wear);
+
+
+// Output thread
+// frames submitted while the thread is busy replace older pending frames
+
+struct flipdot_async_stats {
+	uint32_t submitted;
+	uint32_t displayed;
+	uint32_t dropped;
+	uint32_t last_displayed;	// sequence number of the last displayed frame
+};
+
+int flipdot_async_start(void);
+void flipdot_async_stop(void);
+
+// refresh after idle (ms) without a frame within budget (us), 0 turns it off,
+// call before flipdot_async_start()
+void flipdot_async_set_refresh(uint32_t idle, uint32_t budget);
+
+uint32_t flipdot_async_submit_frame(const uint8_t *frame);
+uint32_t flipdot_async_submit_bitmap(const uint8_t *bitmap);
+
+void flipdot_async_get_stats(struct flipdot_async_stats *stats);
+
 
 #endif /* FLIPDOT_H */
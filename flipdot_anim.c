@@ -0,0 +1,97 @@
+#include <stdint.h>
+#include <string.h>
+#include "flipdot_anim.h"
+#include "flipdot_be.h"
+
+
+static const uint8_t anim_magic[4] = { 'F', 'D', 'A', 'N' };
+
+
+// Write the file header to buf (FLIPDOT_ANIM_HEADER_SIZE bytes)
+size_t
+flipdot_anim_header(uint8_t *buf)
+{
+	memcpy(buf, anim_magic, sizeof(anim_magic));
+	buf[4] = FLIPDOT_ANIM_VERSION;
+	buf[5] = 0;
+	put_be16(buf + 6, FRAME_BYTE_COUNT);
+	put_be16(buf + 8, REGISTER_COLS);
+	put_be16(buf + 10, REGISTER_ROWS);
+
+	return FLIPDOT_ANIM_HEADER_SIZE;
+}
+
+// Write the record of frame to buf (FLIPDOT_ANIM_RECORD_MAX bytes),
+// prev is the previous frame or NULL for the first one
+size_t
+flipdot_anim_record(uint8_t *buf, uint16_t duration, const uint8_t *frame, const uint8_t *prev)
+{
+	flipdot_frame_t zero;
+	size_t len;
+
+	if (!prev) {
+		memset(zero, 0x00, sizeof(zero));
+		prev = zero;
+	}
+
+	len = flipdot_delta_encode(buf + 4, frame, prev);
+	put_be16(buf, duration);
+	put_be16(buf + 2, len);
+
+	return 4 + len;
+}
+
+// Check a whole file once before playing it, so playback needs no checks.
+// Returns the number of frames, 0 if the file is invalid or made
+// for another geometry.
+size_t
+flipdot_anim_check(const uint8_t *data, size_t size)
+{
+	const uint8_t *end = data + size;
+	flipdot_frame_t frame;
+	size_t count = 0;
+
+	if (size < FLIPDOT_ANIM_HEADER_SIZE ||
+		memcmp(data, anim_magic, sizeof(anim_magic)) != 0 ||
+		data[4] != FLIPDOT_ANIM_VERSION ||
+		get_be16(data + 6) != FRAME_BYTE_COUNT ||
+		get_be16(data + 8) != REGISTER_COLS ||
+		get_be16(data + 10) != REGISTER_ROWS) {
+		return 0;
+	}
+
+	data += FLIPDOT_ANIM_HEADER_SIZE;
+	memset(frame, 0x00, sizeof(frame));
+
+	while (data < end) {
+		size_t len;
+
+		if (end - data < 4) {
+			return 0;
+		}
+
+		len = get_be16(data + 2);
+
+		if ((size_t)(end - data - 4) < len || !flipdot_delta_apply(data + 4, len, &frame)) {
+			return 0;
+		}
+
+		data += 4 + len;
+		count++;
+	}
+
+	return count;
+}
+
+// Apply the record to frame, which holds the previous frame (all-0 for the
+// first record). Returns the next record, the file must have been checked.
+const uint8_t *
+flipdot_anim_next(const uint8_t *record, flipdot_frame_t *frame, uint16_t *duration)
+{
+	size_t len = get_be16(record + 2);
+
+	*duration = get_be16(record);
+	flipdot_delta_apply(record + 4, len, frame);
+
+	return record + 4 + len;
+}
@@ -0,0 +1,40 @@
+#ifndef FLIPDOT_ANIM_H
+#define FLIPDOT_ANIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "flipdot.h"
+
+
+// Animation files
+// A header followed by one record per frame up to the end of the file,
+// all fields big endian. Files are made for the geometry in flipdot.h.
+//
+// header:
+//  0  magic    "FDAN"
+//  4  version  FLIPDOT_ANIM_VERSION
+//  5  reserved 0
+//  6  FRAME_BYTE_COUNT
+//  8  REGISTER_COLS
+// 10  REGISTER_ROWS
+//
+// record:
+//  0  duration ms
+//  2  length   delta length
+//  4  delta    frame delta against the previous frame, the first
+//              frame against an all-0 frame, see flipdot_delta_encode()
+
+#define FLIPDOT_ANIM_VERSION 1
+
+#define FLIPDOT_ANIM_HEADER_SIZE 12
+#define FLIPDOT_ANIM_RECORD_MAX (4 + FRAME_BYTE_COUNT)
+
+
+size_t flipdot_anim_header(uint8_t *buf);
+size_t flipdot_anim_record(uint8_t *buf, uint16_t duration, const uint8_t *frame, const uint8_t *prev);
+
+size_t flipdot_anim_check(const uint8_t *data, size_t size);
+const uint8_t *flipdot_anim_next(const uint8_t *record, flipdot_frame_t *frame, uint16_t *duration);
+
+
+#endif /* FLIPDOT_ANIM_H */
@@ -0,0 +1,196 @@
+// sem_clockwait()
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "flipdot.h"
+
+
+// Latest-wins mailbox between one producer and the output thread.
+// Three frame buffers are owned by the producer (back), the mailbox
+// and the output thread (front). Buffers change owner only by atomic
+// exchange with the mailbox, MAILBOX_FRESH marks an unconsumed frame.
+
+#define MAILBOX_INDEX 0x03
+#define MAILBOX_FRESH 0x04
+
+
+static flipdot_frame_t async_frames[3];
+static uint32_t async_seq[3];
+
+static uint8_t mailbox;
+static uint8_t back;
+static uint8_t front;
+
+static struct flipdot_async_stats async_stats;
+
+static sem_t async_sem;
+static pthread_t async_thread;
+static uint8_t async_running;
+
+
+// background refresh, off while refresh_idle is 0
+static uint32_t refresh_idle;	// ms
+static uint32_t refresh_budget;	// us
+
+
+static void
+idle_deadline(struct timespec *deadline)
+{
+	clock_gettime(CLOCK_MONOTONIC, deadline);
+
+	deadline->tv_sec += refresh_idle / 1000;
+	deadline->tv_nsec += (refresh_idle % 1000) * 1000000L;
+	if (deadline->tv_nsec >= 1000000000L) {
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000L;
+	}
+}
+
+// Wait for the next frame. After refresh_idle ms without one, refresh
+// a few rows and wait again.
+static void
+async_wait(void)
+{
+	struct timespec deadline;
+
+	if (refresh_idle) {
+		idle_deadline(&deadline);
+
+		for (;;) {
+			if (sem_clockwait(&async_sem, CLOCK_MONOTONIC, &deadline) == 0) {
+				return;
+			}
+
+			if (errno == ETIMEDOUT) {
+				flipdot_refresh(refresh_budget * 1000ULL);
+				idle_deadline(&deadline);
+			} else if (errno != EINTR) {
+				break;
+			}
+		}
+	}
+
+	while (sem_wait(&async_sem) == -1 && errno == EINTR);
+}
+
+static void *
+async_loop(void *arg)
+{
+	(void)arg;
+
+	for (;;) {
+		uint8_t old;
+
+		async_wait();
+
+		// take the mailbox buffer, leave the displayed one
+		old = __atomic_exchange_n(&mailbox, front, __ATOMIC_ACQ_REL);
+		front = old & MAILBOX_INDEX;
+
+		if (old & MAILBOX_FRESH) {
+			flipdot_update_frame(async_frames[front]);
+
+			__atomic_store_n(&async_stats.last_displayed, async_seq[front], __ATOMIC_RELEASE);
+			__atomic_add_fetch(&async_stats.displayed, 1, __ATOMIC_RELEASE);
+		} else if (!__atomic_load_n(&async_running, __ATOMIC_ACQUIRE)) {
+			// woken up by flipdot_async_stop() with no frame pending
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+
+int
+flipdot_async_start(void)
+{
+	memset(&async_stats, 0, sizeof(async_stats));
+
+	back = 0;
+	mailbox = 1;
+	front = 2;
+
+	if (sem_init(&async_sem, 0, 0) == -1) {
+		return 0;
+	}
+
+	async_running = 1;
+
+	if (pthread_create(&async_thread, NULL, async_loop, NULL) != 0) {
+		async_running = 0;
+		sem_destroy(&async_sem);
+		return 0;
+	}
+
+	return 1;
+}
+
+void
+flipdot_async_set_refresh(uint32_t idle, uint32_t budget)
+{
+	refresh_idle = idle;
+	refresh_budget = budget;
+}
+
+void
+flipdot_async_stop(void)
+{
+	if (!async_running) {
+		return;
+	}
+
+	// the output thread displays a pending frame before it exits
+	__atomic_store_n(&async_running, 0, __ATOMIC_RELEASE);
+	sem_post(&async_sem);
+
+	pthread_join(async_thread, NULL);
+	sem_destroy(&async_sem);
+}
+
+uint32_t
+flipdot_async_submit_frame(const uint8_t *frame)
+{
+	uint32_t seq = async_stats.submitted + 1;
+	uint8_t old;
+
+	memcpy(async_frames[back], frame, sizeof(async_frames[back]));
+	async_seq[back] = seq;
+
+	old = __atomic_exchange_n(&mailbox, back | MAILBOX_FRESH, __ATOMIC_ACQ_REL);
+	back = old & MAILBOX_INDEX;
+
+	__atomic_store_n(&async_stats.submitted, seq, __ATOMIC_RELEASE);
+
+	if (old & MAILBOX_FRESH) {
+		// replaced a frame the output thread did not pick up yet
+		__atomic_add_fetch(&async_stats.dropped, 1, __ATOMIC_RELEASE);
+	} else {
+		sem_post(&async_sem);
+	}
+
+	return seq;
+}
+
+uint32_t
+flipdot_async_submit_bitmap(const uint8_t *bitmap)
+{
+	flipdot_frame_t frame;
+
+	flipdot_bitmap_to_frame(bitmap, &frame);
+	return flipdot_async_submit_frame(frame);
+}
+
+void
+flipdot_async_get_stats(struct flipdot_async_stats *stats)
+{
+	stats->submitted = __atomic_load_n(&async_stats.submitted, __ATOMIC_ACQUIRE);
+	stats->displayed = __atomic_load_n(&async_stats.displayed, __ATOMIC_ACQUIRE);
+	stats->dropped = __atomic_load_n(&async_stats.dropped, __ATOMIC_ACQUIRE);
+	stats->last_displayed = __atomic_load_n(&async_stats.last_displayed, __ATOMIC_ACQUIRE);
+}
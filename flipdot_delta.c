@@ -0,0 +1,111 @@
+#include <stdint.h>
+#include <string.h>
+#include "flipdot.h"
+
+
+// Frame deltas
+// The XOR of two frames as pairs of (skip, count) bytes: skip unchanged
+// bytes, then XOR the next count bytes that follow the pair. A delta
+// that would not be smaller than the frame is stored as the frame itself,
+// with a length of FRAME_BYTE_COUNT.
+
+static size_t
+delta_xor(uint8_t *delta, const uint8_t *frame, const uint8_t *prev)
+{
+	size_t len = 0;
+	size_t i = 0;
+
+	while (i < FRAME_BYTE_COUNT) {
+		size_t skip = 0;
+		size_t count = 0;
+
+		while (skip < 255 && i + skip < FRAME_BYTE_COUNT && frame[i + skip] == prev[i + skip]) {
+			skip++;
+		}
+
+		if (i + skip == FRAME_BYTE_COUNT) {
+			// trailing unchanged bytes need no pair
+			break;
+		}
+
+		while (count < 255 && i + skip + count < FRAME_BYTE_COUNT &&
+			frame[i + skip + count] != prev[i + skip + count]) {
+			count++;
+		}
+
+		if (len + 2 + count >= FRAME_BYTE_COUNT) {
+			return FRAME_BYTE_COUNT;
+		}
+
+		delta[len++] = skip;
+		delta[len++] = count;
+		i += skip;
+
+		for (size_t j = 0; j < count; j++, i++) {
+			delta[len++] = frame[i] ^ prev[i];
+		}
+	}
+
+	return len;
+}
+
+
+// Encode frame against prev into delta (FRAME_BYTE_COUNT bytes),
+// prev NULL stores the frame. Returns the delta length.
+size_t
+flipdot_delta_encode(uint8_t *delta, const uint8_t *frame, const uint8_t *prev)
+{
+	size_t len = FRAME_BYTE_COUNT;
+
+	if (prev) {
+		len = delta_xor(delta, frame, prev);
+	}
+
+	if (len == FRAME_BYTE_COUNT) {
+		memcpy(delta, frame, FRAME_BYTE_COUNT);
+	}
+
+	return len;
+}
+
+// Apply a delta of len bytes to frame, which must hold prev.
+// Returns 0 if the delta is corrupt, frame is undefined then.
+int
+flipdot_delta_apply(const uint8_t *delta, size_t len, flipdot_frame_t *frame)
+{
+	uint8_t *dst = *frame;
+	size_t pos = 0;
+	size_t i = 0;
+
+	if (len == FRAME_BYTE_COUNT) {
+		memcpy(dst, delta, FRAME_BYTE_COUNT);
+		return 1;
+	}
+
+	if (len > FRAME_BYTE_COUNT) {
+		return 0;
+	}
+
+	while (pos < len) {
+		size_t skip, count;
+
+		if (len - pos < 2) {
+			return 0;
+		}
+
+		skip = delta[pos++];
+		count = delta[pos++];
+
+		if (count > len - pos || i + skip + count > FRAME_BYTE_COUNT) {
+			return 0;
+		}
+
+		i += skip;
+
+		for (size_t j = 0; j < count; j++) {
+			dst[i++] ^= delta[pos++];
+		}
+	}
+
+	return 1;
+}
@@ -0,0 +1,145 @@
+#include <stdint.h>
+#include <string.h>
+#include "flipdot.h"
+
+
+// Every update gets the frame interval minus the time earlier updates
+// overran their budget. Estimates are corrected by the measured ratio of
+// actual to estimated duration, a 16.16 fixed point moving average.
+
+#define SCALE_ONE 65536
+#define SCALE_MIN (SCALE_ONE / 4)
+#define SCALE_MAX (SCALE_ONE * 16)
+
+
+static uint64_t gov_interval;
+static int64_t gov_debt;
+static uint32_t gov_scale = SCALE_ONE;
+
+// first row of the next partial update
+static uint_fast16_t gov_cursor;
+
+static struct flipdot_governor_stats gov_stats;
+
+
+static uint64_t
+scaled(uint64_t duration)
+{
+	return (duration * gov_scale) >> 16;
+}
+
+// Take the changed rows of frame new from the cursor on while they fit
+// into max_pulses, a row needs at most one pulse per polarity.
+// The cursor stops at the first row left out.
+static void
+partial_frame(const uint8_t *old, const uint8_t *new, flipdot_frame_t *frame, uint32_t max_pulses)
+{
+	memcpy(frame, old, sizeof(*frame));
+
+	for (uint_fast16_t n = 0; n < REGISTER_ROWS; n++) {
+		uint_fast16_t row = (gov_cursor + n) % REGISTER_ROWS;
+		const uint8_t *from = old + (row * REGISTER_COL_BYTE_COUNT);
+		const uint8_t *to = new + (row * REGISTER_COL_BYTE_COUNT);
+		uint8_t to_0 = 0, to_1 = 0;
+		uint32_t pulses;
+
+		for (uint_fast16_t i = 0; i < REGISTER_COL_BYTE_COUNT; i++) {
+			to_0 |= from[i] & ~to[i];
+			to_1 |= ~from[i] & to[i];
+		}
+
+		pulses = (to_0 != 0) + (to_1 != 0);
+		if (pulses > max_pulses) {
+			// a row that needs both polarities gets its flips to 0 first
+			if (max_pulses) {
+				for (uint_fast16_t i = 0; i < REGISTER_COL_BYTE_COUNT; i++) {
+					(*frame)[(row * REGISTER_COL_BYTE_COUNT) + i] = from[i] & to[i];
+				}
+			}
+
+			gov_cursor = row;
+			return;
+		}
+
+		max_pulses -= pulses;
+		memcpy(*frame + (row * REGISTER_COL_BYTE_COUNT), to, REGISTER_COL_BYTE_COUNT);
+	}
+}
+
+
+void
+flipdot_governor_init(uint64_t interval)
+{
+	gov_interval = interval;
+	gov_debt = 0;
+	gov_scale = SCALE_ONE;
+	gov_cursor = 0;
+
+	memset(&gov_stats, 0, sizeof(gov_stats));
+	gov_stats.scale = gov_scale;
+}
+
+int
+flipdot_governor_update_frame(const uint8_t *frame)
+{
+	flipdot_frame_t shown, partial;
+	struct flipdot_cost cost;
+	const uint8_t *next = frame;
+	int64_t budget = gov_interval - gov_debt;
+	uint64_t start = flipdot_now();
+	uint64_t estimate;
+	int64_t elapsed;
+	int result = FLIPDOT_GOVERN_FULL;
+
+	flipdot_get_frame(&shown);
+	flipdot_estimate_update(shown, frame, &cost);
+	estimate = scaled(cost.duration);
+
+	if ((int64_t)estimate > budget) {
+		uint32_t max_pulses = 0;
+
+		if (budget > 0 && cost.pulses) {
+			max_pulses = budget / (estimate / cost.pulses);
+		}
+
+		if (max_pulses == 0) {
+			// pay off the overrun, the frame is handled by the next update
+			gov_debt = (budget < 0) ? -budget : 0;
+			gov_stats.skipped++;
+			return FLIPDOT_GOVERN_SKIP;
+		}
+
+		partial_frame(shown, frame, &partial, max_pulses);
+		flipdot_estimate_update(shown, partial, &cost);
+
+		next = partial;
+		result = FLIPDOT_GOVERN_PARTIAL;
+	}
+
+	flipdot_update_frame(next);
+	elapsed = flipdot_now() - start;
+
+	if (cost.duration) {
+		uint64_t ratio = ((uint64_t)elapsed << 16) / cost.duration;
+
+		ratio = ((uint64_t)gov_scale * 7 + ratio) / 8;
+		gov_scale = (ratio < SCALE_MIN) ? SCALE_MIN : (ratio > SCALE_MAX) ? SCALE_MAX : ratio;
+	}
+
+	gov_debt = (elapsed > budget) ? elapsed - budget : 0;
+
+	if (result == FLIPDOT_GOVERN_FULL) {
+		gov_stats.full++;
+	} else {
+		gov_stats.partial++;
+	}
+	gov_stats.scale = gov_scale;
+
+	return result;
+}
+
+void
+flipdot_governor_get_stats(struct flipdot_governor_stats *stats)
+{
+	*stats = gov_stats;
+}
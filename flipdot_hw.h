@@ -0,0 +1,75 @@
+#ifndef FLIPDOT_HW_H
+#define FLIPDOT_HW_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "flipdot.h"
+
+
+// Hardware backend
+// GPIO masks use the BCM2835 GPIO numbers from the pin mapping in flipdot.h
+
+struct flipdot_hw {
+	const char *name;
+
+	// returns 0 on failure
+	int (*init)(void);
+	void (*shutdown)(void);
+
+	void (*set_multi)(uint32_t mask);
+	void (*clr_multi)(uint32_t mask);
+
+	// clear and set GPIOs in a single write, clr and set do not overlap
+	void (*write)(uint32_t clr, uint32_t set);
+
+	// optional, default to nanosleep and CLOCK_MONOTONIC (ns)
+	void (*sleep)(long nsec);
+	uint64_t (*now)(void);
+};
+
+#define HW_PIN_COUNT (5 + (2 * CHAIN_COUNT))
+#define HW_PINS { OE0, OE1, STROBE, ROW_CLK, COL_CLK, CHAIN_ROW_DATA, CHAIN_COL_DATA }
+
+
+// bcm2835 library, memory mapped GPIO registers
+// bcm2835_init() is called by the backend if the application did not
+extern const struct flipdot_hw flipdot_hw_bcm2835;
+
+// Linux GPIO character device (GPIOCHIP_DEV), one ioctl per GPIO write
+extern const struct flipdot_hw flipdot_hw_gpiochip;
+
+// In-process simulation of GPIOs, shift registers and dots
+extern const struct flipdot_hw flipdot_hw_sim;
+
+
+// Simulator
+
+// virtual duration of a GPIO write (ns)
+#define SIM_WRITE_DELAY 20
+
+struct flipdot_sim_edge {
+	uint64_t time;		// virtual time (ns)
+	uint32_t levels;	// GPIO levels after the write
+	uint32_t changed;	// GPIOs changed by the write
+};
+
+struct flipdot_sim_stats {
+	uint64_t time;		// virtual time (ns)
+	uint64_t writes;	// GPIO writes
+	uint64_t edges;		// GPIO writes that changed levels
+	uint64_t row_clocks;
+	uint64_t col_clocks;
+	uint64_t strobes;
+	uint64_t pulses_0;
+	uint64_t pulses_1;
+	uint64_t oe_overlaps;	// OE0 and OE1 set at the same time
+};
+
+void flipdot_sim_reset(void);
+void flipdot_sim_log(struct flipdot_sim_edge *log, size_t size);
+size_t flipdot_sim_log_count(void);
+void flipdot_sim_get_stats(struct flipdot_sim_stats *stats);
+void flipdot_sim_get_frame(flipdot_frame_t *frame);
+
+
+#endif /* FLIPDOT_HW_H */
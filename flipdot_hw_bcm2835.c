@@ -0,0 +1,86 @@
+#include <stdint.h>
+#include <sys/mman.h>
+#include <bcm2835.h>
+#include "flipdot_hw.h"
+
+
+static const uint8_t pins[HW_PIN_COUNT] = HW_PINS;
+
+static uint32_t pin_mask;
+
+
+static void
+bcm2835_set_multi(uint32_t mask)
+{
+	bcm2835_gpio_set_multi(mask);
+}
+
+static void
+bcm2835_clr_multi(uint32_t mask)
+{
+	bcm2835_gpio_clr_multi(mask);
+}
+
+// two register stores, there is no single register for both
+static void
+bcm2835_write(uint32_t clr, uint32_t set)
+{
+	if (clr) {
+		bcm2835_gpio_clr_multi(clr);
+	}
+
+	if (set) {
+		bcm2835_gpio_set_multi(set);
+	}
+}
+
+static int
+bcm2835_hw_init(void)
+{
+	// applications may have called bcm2835_init() before dropping privileges
+	if (bcm2835_gpio == MAP_FAILED && !bcm2835_init()) {
+		return 0;
+	}
+
+	for (uint_fast8_t i = 0; i < HW_PIN_COUNT; i++) {
+		pin_mask |= (1UL << pins[i]);
+	}
+
+	// clear ports
+	bcm2835_gpio_clr_multi(pin_mask);
+
+	for (uint_fast8_t i = 0; i < HW_PIN_COUNT; i++) {
+		// set ports to output
+		bcm2835_gpio_fsel(pins[i], BCM2835_GPIO_FSEL_OUTP);
+
+		// TODO: is this really useful? better use external pull-down
+		bcm2835_gpio_set_pud(pins[i], BCM2835_GPIO_PUD_DOWN);
+	}
+
+	return 1;
+}
+
+static void
+bcm2835_hw_shutdown(void)
+{
+	// clear ports
+	bcm2835_gpio_clr_multi(pin_mask);
+
+	// set ports to input
+	// TODO: disable pull-ups?
+	for (uint_fast8_t i = 0; i < HW_PIN_COUNT; i++) {
+		bcm2835_gpio_fsel(pins[i], BCM2835_GPIO_FSEL_INPT);
+	}
+}
+
+
+const struct flipdot_hw flipdot_hw_bcm2835 = {
+	.name = "bcm2835",
+	.init = bcm2835_hw_init,
+	.shutdown = bcm2835_hw_shutdown,
+	.set_multi = bcm2835_set_multi,
+	.clr_multi = bcm2835_clr_multi,
+	.write = bcm2835_write,
+	.sleep = NULL,
+	.now = NULL,
+};
@@ -0,0 +1,139 @@
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include "flipdot_hw.h"
+
+
+#if (HW_PIN_COUNT > GPIO_V2_LINES_MAX)
+#error "too many GPIOs for one gpiochip line request"
+#endif
+
+
+static const uint8_t pins[HW_PIN_COUNT] = HW_PINS;
+
+// line request file descriptor
+static int line_fd = -1;
+
+
+// translate a GPIO mask into line bits of the request
+static uint64_t
+gpiochip_lines(uint32_t mask)
+{
+	uint64_t lines = 0;
+
+	for (uint_fast8_t i = 0; i < HW_PIN_COUNT; i++) {
+		if (mask & (1UL << pins[i])) {
+			lines |= (1ULL << i);
+		}
+	}
+
+	return lines;
+}
+
+static void
+gpiochip_set_multi(uint32_t mask)
+{
+	struct gpio_v2_line_values values;
+
+	values.mask = gpiochip_lines(mask);
+	values.bits = values.mask;
+
+	ioctl(line_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values);
+}
+
+static void
+gpiochip_write(uint32_t clr, uint32_t set)
+{
+	struct gpio_v2_line_values values;
+
+	values.mask = gpiochip_lines(clr | set);
+	values.bits = gpiochip_lines(set);
+
+	ioctl(line_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values);
+}
+
+static void
+gpiochip_clr_lines(uint64_t lines)
+{
+	struct gpio_v2_line_values values;
+
+	values.mask = lines;
+	values.bits = 0;
+
+	ioctl(line_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values);
+}
+
+static void
+gpiochip_clr_multi(uint32_t mask)
+{
+	gpiochip_clr_lines(gpiochip_lines(mask));
+}
+
+static int
+gpiochip_init(void)
+{
+	struct gpio_v2_line_request req;
+	int chip_fd;
+
+	if ((chip_fd = open(GPIOCHIP_DEV, O_RDWR | O_CLOEXEC)) == -1) {
+		return 0;
+	}
+
+	memset(&req, 0, sizeof(req));
+
+	for (uint_fast8_t i = 0; i < HW_PIN_COUNT; i++) {
+		req.offsets[i] = pins[i];
+	}
+	req.num_lines = HW_PIN_COUNT;
+	strncpy(req.consumer, "flipdot", sizeof(req.consumer) - 1);
+
+	// outputs, initially cleared
+	// TODO: is this really useful? better use external pull-down
+	req.config.flags = GPIO_V2_LINE_FLAG_OUTPUT | GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN;
+
+	if (ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req) == -1) {
+		close(chip_fd);
+		return 0;
+	}
+
+	close(chip_fd);
+	line_fd = req.fd;
+
+	return 1;
+}
+
+static void
+gpiochip_shutdown(void)
+{
+	struct gpio_v2_line_config config;
+
+	if (line_fd == -1) {
+		return;
+	}
+
+	// clear ports
+	gpiochip_clr_lines(~0ULL >> (64 - HW_PIN_COUNT));
+
+	// set ports to input
+	memset(&config, 0, sizeof(config));
+	config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN;
+	ioctl(line_fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config);
+
+	close(line_fd);
+	line_fd = -1;
+}
+
+
+const struct flipdot_hw flipdot_hw_gpiochip = {
+	.name = "gpiochip",
+	.init = gpiochip_init,
+	.shutdown = gpiochip_shutdown,
+	.set_multi = gpiochip_set_multi,
+	.clr_multi = gpiochip_clr_multi,
+	.write = gpiochip_write,
+	.sleep = NULL,
+	.now = NULL,
+};
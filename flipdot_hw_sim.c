@@ -0,0 +1,214 @@
+#include <stdint.h>
+#include <string.h>
+#include "flipdot_hw.h"
+
+
+#define ISBITSET(b,i) (((((uint8_t *)(b))[(i) >> 3]) & (1 << ((i) & 7))) != 0)
+
+
+static const uint8_t row_data_pins[CHAIN_COUNT] = { CHAIN_ROW_DATA };
+static const uint8_t col_data_pins[CHAIN_COUNT] = { CHAIN_COL_DATA };
+
+static uint32_t levels;
+static struct flipdot_sim_stats stats;
+
+static struct flipdot_sim_edge *log_buf;
+static size_t log_size;
+static size_t log_count;
+
+// shift registers of every chain, bit 0 is the last bit shifted in
+static flipdot_row_reg_t row_sreg[CHAIN_COUNT], row_latch[CHAIN_COUNT];
+static uint8_t col_sreg[CHAIN_COUNT][CHAIN_COL_BYTE_COUNT], col_latch[CHAIN_COUNT][CHAIN_COL_BYTE_COUNT];
+
+// modeled dot positions
+static flipdot_frame_t dots;
+
+
+static void
+sim_shift(uint8_t *reg, uint_fast16_t size, uint_fast8_t data)
+{
+	for (uint_fast16_t i = size; i-- > 0;) {
+		reg[i] = (reg[i] << 1) | ((i > 0) ? (reg[i-1] >> 7) : data);
+	}
+}
+
+static void
+sim_flip(uint_fast8_t oe)
+{
+	uint8_t *dotptr = dots;
+
+	for (uint_fast16_t row = 0; row < REGISTER_ROWS; row++) {
+		for (uint_fast8_t chain = 0; chain < CHAIN_COUNT; chain++) {
+			uint8_t *chainptr = dotptr + (chain * CHAIN_COL_BYTE_COUNT);
+
+			if (!ISBITSET(row_latch[chain], row)) {
+				continue;
+			}
+
+			for (uint_fast16_t col = 0; col < CHAIN_COL_BYTE_COUNT; col++) {
+				// 0-bits select dots to flip to 0, 1-bits dots to flip to 1
+				if (oe == 0) {
+					chainptr[col] &= col_latch[chain][col];
+				} else {
+					chainptr[col] |= col_latch[chain][col];
+				}
+			}
+		}
+
+		dotptr += REGISTER_COL_BYTE_COUNT;
+	}
+}
+
+static void
+sim_write(uint32_t new_levels)
+{
+	uint32_t changed = levels ^ new_levels;
+	uint32_t rising = changed & new_levels;
+
+	stats.time += SIM_WRITE_DELAY;
+	stats.writes++;
+	levels = new_levels;
+
+	if (!changed) {
+		return;
+	}
+
+	stats.edges++;
+
+	if (log_buf && log_count < log_size) {
+		log_buf[log_count].time = stats.time;
+		log_buf[log_count].levels = levels;
+		log_buf[log_count].changed = changed;
+		log_count++;
+	}
+
+	if (rising & (1UL << ROW_CLK)) {
+		for (uint_fast8_t chain = 0; chain < CHAIN_COUNT; chain++) {
+			sim_shift(row_sreg[chain], sizeof(row_sreg[chain]), (levels & (1UL << row_data_pins[chain])) != 0);
+		}
+		stats.row_clocks++;
+	}
+
+	if (rising & (1UL << COL_CLK)) {
+		for (uint_fast8_t chain = 0; chain < CHAIN_COUNT; chain++) {
+			sim_shift(col_sreg[chain], sizeof(col_sreg[chain]), (levels & (1UL << col_data_pins[chain])) != 0);
+		}
+		stats.col_clocks++;
+	}
+
+	if (rising & (1UL << STROBE)) {
+		memcpy(row_latch, row_sreg, sizeof(row_latch));
+		memcpy(col_latch, col_sreg, sizeof(col_latch));
+		stats.strobes++;
+	}
+
+	if ((levels & (1UL << OE0)) && (levels & (1UL << OE1))) {
+		stats.oe_overlaps++;
+	}
+
+	if (rising & (1UL << OE0)) {
+		sim_flip(0);
+		stats.pulses_0++;
+	}
+
+	if (rising & (1UL << OE1)) {
+		sim_flip(1);
+		stats.pulses_1++;
+	}
+}
+
+static void
+sim_set_multi(uint32_t mask)
+{
+	sim_write(levels | mask);
+}
+
+static void
+sim_clr_multi(uint32_t mask)
+{
+	sim_write(levels & ~mask);
+}
+
+static void
+sim_write_multi(uint32_t clr, uint32_t set)
+{
+	sim_write((levels & ~clr) | set);
+}
+
+static void
+sim_sleep(long nsec)
+{
+	stats.time += nsec;
+}
+
+static uint64_t
+sim_now(void)
+{
+	return stats.time;
+}
+
+static int
+sim_init(void)
+{
+	levels = 0;
+	return 1;
+}
+
+static void
+sim_shutdown(void)
+{
+	levels = 0;
+}
+
+
+void
+flipdot_sim_reset(void)
+{
+	levels = 0;
+	log_count = 0;
+
+	memset(&stats, 0, sizeof(stats));
+	memset(row_sreg, 0, sizeof(row_sreg));
+	memset(row_latch, 0, sizeof(row_latch));
+	memset(col_sreg, 0, sizeof(col_sreg));
+	memset(col_latch, 0, sizeof(col_latch));
+	memset(dots, 0, sizeof(dots));
+}
+
+void
+flipdot_sim_log(struct flipdot_sim_edge *log, size_t size)
+{
+	log_buf = log;
+	log_size = size;
+	log_count = 0;
+}
+
+size_t
+flipdot_sim_log_count(void)
+{
+	return log_count;
+}
+
+void
+flipdot_sim_get_stats(struct flipdot_sim_stats *s)
+{
+	*s = stats;
+}
+
+void
+flipdot_sim_get_frame(flipdot_frame_t *frame)
+{
+	memcpy(frame, dots, sizeof(*frame));
+}
+
+
+const struct flipdot_hw flipdot_hw_sim = {
+	.name = "sim",
+	.init = sim_init,
+	.shutdown = sim_shutdown,
+	.set_multi = sim_set_multi,
+	.clr_multi = sim_clr_multi,
+	.write = sim_write_multi,
+	.sleep = sim_sleep,
+	.now = sim_now,
+};
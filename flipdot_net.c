@@ -0,0 +1,115 @@
+#include <stdint.h>
+#include <string.h>
+#include "flipdot_net.h"
+#include "flipdot_be.h"
+
+
+#define NET_MAGIC_0 'F'
+#define NET_MAGIC_1 'D'
+
+
+static size_t
+put_header(uint8_t *packet, uint8_t type, uint32_t seq, uint16_t tile, uint64_t pts, size_t len)
+{
+	packet[0] = NET_MAGIC_0;
+	packet[1] = NET_MAGIC_1;
+	packet[2] = FLIPDOT_NET_VERSION;
+	packet[3] = type;
+	put_be32(packet + 4, seq);
+	put_be16(packet + 8, tile);
+	put_be16(packet + 10, len);
+	put_be64(packet + 12, pts);
+
+	return FLIPDOT_NET_HEADER_SIZE + len;
+}
+
+
+// Encode the frame of a tile into packet (FLIPDOT_NET_PACKET_MAX bytes).
+// Deltas are encoded against prev, the frame of seq - 1, prev NULL
+// forces a key frame. Returns the packet length.
+size_t
+flipdot_net_encode(uint8_t *packet, uint32_t seq, uint16_t tile, uint64_t pts, const uint8_t *frame, const uint8_t *prev)
+{
+	size_t len = flipdot_delta_encode(packet + FLIPDOT_NET_HEADER_SIZE, frame, prev);
+
+	return put_header(packet, (len == FRAME_BYTE_COUNT) ? FLIPDOT_NET_KEY : FLIPDOT_NET_DELTA,
+					seq, tile, pts, len);
+}
+
+// Returns 0 if packet is not a valid packet
+int
+flipdot_net_parse(const uint8_t *packet, size_t len, struct flipdot_net_header *header)
+{
+	if (len < FLIPDOT_NET_HEADER_SIZE ||
+		packet[0] != NET_MAGIC_0 || packet[1] != NET_MAGIC_1 ||
+		packet[2] != FLIPDOT_NET_VERSION) {
+		return 0;
+	}
+
+	header->type = packet[3];
+	header->seq = get_be32(packet + 4);
+	header->tile = get_be16(packet + 8);
+	header->length = get_be16(packet + 10);
+	header->pts = get_be64(packet + 12);
+
+	if (header->length != len - FLIPDOT_NET_HEADER_SIZE) {
+		return 0;
+	}
+
+	switch (header->type) {
+		case FLIPDOT_NET_KEY:
+			return (header->length == FRAME_BYTE_COUNT);
+
+		case FLIPDOT_NET_DELTA:
+			return (header->length < FRAME_BYTE_COUNT);
+
+		case FLIPDOT_NET_SYNC_REQUEST:
+			return (header->length == 8);
+
+		case FLIPDOT_NET_SYNC_REPLY:
+			return (header->length == 24);
+	}
+
+	return 0;
+}
+
+// Apply the payload of a parsed packet to frame, which must hold the
+// frame of seq - 1 for deltas. Returns 0 if the payload is corrupt,
+// frame is undefined then until the next key frame.
+int
+flipdot_net_apply(const uint8_t *packet, const struct flipdot_net_header *header, flipdot_frame_t *frame)
+{
+	return flipdot_delta_apply(packet + FLIPDOT_NET_HEADER_SIZE, header->length, frame);
+}
+
+// Clock sync packets
+
+size_t
+flipdot_net_sync_request(uint8_t *packet, uint64_t t1)
+{
+	put_be64(packet + FLIPDOT_NET_HEADER_SIZE, t1);
+	return put_header(packet, FLIPDOT_NET_SYNC_REQUEST, 0, 0, 0, 8);
+}
+
+// Reply to a parsed request received at t2, sent at t3
+size_t
+flipdot_net_sync_reply(uint8_t *packet, const uint8_t *request, uint64_t t2, uint64_t t3)
+{
+	memmove(packet + FLIPDOT_NET_HEADER_SIZE, request + FLIPDOT_NET_HEADER_SIZE, 8);
+	put_be64(packet + FLIPDOT_NET_HEADER_SIZE + 8, t2);
+	put_be64(packet + FLIPDOT_NET_HEADER_SIZE + 16, t3);
+	return put_header(packet, FLIPDOT_NET_SYNC_REPLY, 0, 0, 0, 24);
+}
+
+// Sender clock minus node clock and round trip time of a parsed reply
+// received at t4. The offset error is at most half the round trip time.
+void
+flipdot_net_sync_result(const uint8_t *reply, uint64_t t4, int64_t *offset, uint64_t *rtt)
+{
+	uint64_t t1 = get_be64(reply + FLIPDOT_NET_HEADER_SIZE);
+	uint64_t t2 = get_be64(reply + FLIPDOT_NET_HEADER_SIZE + 8);
+	uint64_t t3 = get_be64(reply + FLIPDOT_NET_HEADER_SIZE + 16);
+
+	*offset = ((int64_t)(t2 - t1) + (int64_t)(t3 - t4)) / 2;
+	*rtt = (t4 - t1) - (t3 - t2);
+}
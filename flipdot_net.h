@@ -0,0 +1,61 @@
+#ifndef FLIPDOT_NET_H
+#define FLIPDOT_NET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "flipdot.h"
+
+
+// Frame packets for walls of several displays (tiles) fed over UDP.
+// All tiles share the geometry in flipdot.h, each packet carries the
+// frame of one tile. All fields are big endian.
+//
+//  0  magic   "FD"
+//  2  version FLIPDOT_NET_VERSION
+//  3  type    FLIPDOT_NET_*
+//  4  seq     frame sequence number, counts up by 1 per frame
+//  8  tile    tile id
+// 10  length  payload length
+// 12  pts     presentation time on the sender clock (ns), 0 for none
+// 20  payload
+//
+// A key payload is the frame. A delta payload is the delta of the frame
+// against the frame of seq - 1, see flipdot_delta_encode().
+//
+// Nodes sync their clocks to the sender NTP style: a sync request
+// carries the send time t1 on the node clock, the reply echoes t1 and
+// adds receive time t2 and send time t3 on the sender clock.
+
+#define FLIPDOT_NET_VERSION 2
+
+#define FLIPDOT_NET_KEY 0
+#define FLIPDOT_NET_DELTA 1
+#define FLIPDOT_NET_SYNC_REQUEST 2
+#define FLIPDOT_NET_SYNC_REPLY 3
+
+#define FLIPDOT_NET_HEADER_SIZE 20
+
+// a delta larger than the frame is sent as key frame,
+// sync replies have 24 bytes payload
+#define FLIPDOT_NET_PACKET_MAX (FLIPDOT_NET_HEADER_SIZE + ((FRAME_BYTE_COUNT > 24) ? FRAME_BYTE_COUNT : 24))
+
+
+struct flipdot_net_header {
+	uint8_t type;
+	uint32_t seq;
+	uint16_t tile;
+	uint16_t length;
+	uint64_t pts;
+};
+
+
+size_t flipdot_net_encode(uint8_t *packet, uint32_t seq, uint16_t tile, uint64_t pts, const uint8_t *frame, const uint8_t *prev);
+int flipdot_net_parse(const uint8_t *packet, size_t len, struct flipdot_net_header *header);
+int flipdot_net_apply(const uint8_t *packet, const struct flipdot_net_header *header, flipdot_frame_t *frame);
+
+size_t flipdot_net_sync_request(uint8_t *packet, uint64_t t1);
+size_t flipdot_net_sync_reply(uint8_t *packet, const uint8_t *request, uint64_t t2, uint64_t t3);
+void flipdot_net_sync_result(const uint8_t *reply, uint64_t t4, int64_t *offset, uint64_t *rtt);
+
+
+#endif /* FLIPDOT_NET_H */
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "flipdot.h"
+#include "flipdot_be.h"
+
+
+static const uint8_t wear_magic[4] = { 'F', 'D', 'W', 'R' };
+
+
+// Write a binary PGM heatmap of wear to buf (FLIPDOT_WEAR_PGM_MAX bytes),
+// the most flipped dot is white, every dot that flipped at all is not black
+size_t
+flipdot_wear_pgm(uint8_t *buf, const uint32_t *wear)
+{
+	uint32_t max = 0;
+	int len;
+
+	for (uint_fast16_t i = 0; i < DISP_PIXEL_COUNT; i++) {
+		if (wear[i] > max) {
+			max = wear[i];
+		}
+	}
+
+	len = snprintf((char *)buf, FLIPDOT_WEAR_PGM_MAX, "P5\n%d %d\n255\n", DISP_COLS, DISP_ROWS);
+
+	for (uint_fast16_t i = 0; i < DISP_PIXEL_COUNT; i++) {
+		buf[len + i] = max ? (((uint64_t)wear[i] * 255) + max - 1) / max : 0;
+	}
+
+	return len + DISP_PIXEL_COUNT;
+}
+
+// Write a snapshot of wear to buf (FLIPDOT_WEAR_SNAPSHOT_MAX bytes)
+size_t
+flipdot_wear_snapshot(uint8_t *buf, const uint32_t *wear)
+{
+	uint8_t *p = buf + FLIPDOT_WEAR_HEADER_SIZE;
+
+	memcpy(buf, wear_magic, sizeof(wear_magic));
+	buf[4] = FLIPDOT_WEAR_VERSION;
+	buf[5] = 0;
+	put_be16(buf + 6, DISP_COLS);
+	put_be16(buf + 8, DISP_ROWS);
+
+	for (uint_fast16_t i = 0; i < DISP_PIXEL_COUNT; i++) {
+		uint32_t v = wear[i];
+
+		while (v >= 0x80) {
+			*p++ = v | 0x80;
+			v >>= 7;
+		}
+		*p++ = v;
+	}
+
+	return p - buf;
+}
+
+// Read a snapshot into wear.
+// Returns 0 if it is invalid or made for another geometry.
+int
+flipdot_wear_load(const uint8_t *data, size_t size, flipdot_wear_t *wear)
+{
+	const uint8_t *p = data + FLIPDOT_WEAR_HEADER_SIZE;
+	const uint8_t *end = data + size;
+
+	if (size < FLIPDOT_WEAR_HEADER_SIZE ||
+		memcmp(data, wear_magic, sizeof(wear_magic)) != 0 ||
+		data[4] != FLIPDOT_WEAR_VERSION ||
+		get_be16(data + 6) != DISP_COLS ||
+		get_be16(data + 8) != DISP_ROWS) {
+		return 0;
+	}
+
+	for (uint_fast16_t i = 0; i < DISP_PIXEL_COUNT; i++) {
+		uint32_t v = 0;
+		uint_fast8_t shift = 0;
+
+		do {
+			// the 5th byte holds bits 28 to 31 and ends the count
+			if (p == end || (shift == 28 && *p > 0x0F)) {
+				return 0;
+			}
+			v |= (uint32_t)(*p & 0x7F) << shift;
+			shift += 7;
+		} while (*p++ & 0x80);
+
+		(*wear)[i] = v;
+	}
+
+	return p == end;
+}
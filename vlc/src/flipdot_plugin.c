@@ -7,7 +7,12 @@
 #include <vlc_picture_pool.h>
 #include <assert.h>
 
-#include <bcm2835.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include "flipdot.h"
 
 #ifndef N_
@@ -25,7 +30,13 @@
 #define FD_HEIGHT_LONGTEXT N_("Number of modules per column")
 
 #define FD_THRESH_TEXT N_("Brightness threshold")
-#define FD_THRESH_LONGTEXT N_("")
+#define FD_THRESH_LONGTEXT N_("Pixels up to this luma set their dot")
+
+#define FD_DITHER_TEXT N_("Ordered dithering")
+#define FD_DITHER_LONGTEXT N_("Spread the threshold over an 8x8 Bayer pattern")
+
+#define FD_HYST_TEXT N_("Hysteresis")
+#define FD_HYST_LONGTEXT N_("Luma distance from the threshold a pixel needs to flip its dot")
 
 static int  Open (vlc_object_t *);
 static void Close(vlc_object_t *);
@@ -37,7 +48,9 @@ vlc_module_begin()
 	set_description(N_("Flip Dot Matrix video output"))
 //	add_integer("width", 1, FD_WIDTH_TEXT, FD_WIDTH_LONGTEXT, false)
 //	add_integer("height", 1, FD_HEIGHT_TEXT, FD_HEIGHT_LONGTEXT, false)
-//	add_integer_with_range("threshold", 129, 0, 255, FD_THRESH_TEXT, FD_THRESH_LONGTEXT, false)
+	add_integer_with_range("flipdot-threshold", 127, 0, 255, FD_THRESH_TEXT, FD_THRESH_LONGTEXT, false)
+	add_bool("flipdot-dither", false, FD_DITHER_TEXT, FD_DITHER_LONGTEXT, false)
+	add_integer_with_range("flipdot-hysteresis", 0, 0, 255, FD_HYST_TEXT, FD_HYST_LONGTEXT, false)
 	set_capability("vout display", 0)
 	set_callbacks(Open, Close)
 vlc_module_end()
@@ -52,11 +65,64 @@ static void           Display(vout_display_t *, picture_t *, subpicture_t *);
 static int            Control(vout_display_t *, int, va_list);
 
 
+// flips, late and dropped frames are logged every REPORT_FRAMES frames
+#define REPORT_FRAMES 100
+
+
 struct vout_display_sys_t {
 	flipdot_frame_t *frame;
 	picture_pool_t *pool;
+
+	// a dot is set at luma <= threshold_on and kept at luma <= threshold_keep,
+	// one row per Bayer row when dithering
+	uint8_t threshold_on[8][DISP_COLS];
+	uint8_t threshold_keep[8][DISP_COLS];
+	unsigned threshold_rows;
+	int hysteresis;
+
+	unsigned frames;
+	unsigned long flips;
+	unsigned flips_max;
+	unsigned late;
+	uint32_t dropped;
+};
+
+
+static const uint8_t bayer[8][8] = {
+	{  0, 32,  8, 40,  2, 34, 10, 42 },
+	{ 48, 16, 56, 24, 50, 18, 58, 26 },
+	{ 12, 44,  4, 36, 14, 46,  6, 38 },
+	{ 60, 28, 52, 20, 62, 30, 54, 22 },
+	{  3, 35, 11, 43,  1, 33,  9, 41 },
+	{ 51, 19, 59, 27, 49, 17, 57, 25 },
+	{ 15, 47,  7, 39, 13, 45,  5, 37 },
+	{ 63, 31, 55, 23, 61, 29, 53, 21 }
 };
 
+static uint8_t Clamp(int value)
+{
+	return (value < 0) ? 0 : (value > 255) ? 255 : value;
+}
+
+/**
+ * Fill the per-pixel threshold rows
+ */
+static void SetupThresholds(vout_display_sys_t *sys, int threshold, bool dither, int hysteresis)
+{
+	sys->threshold_rows = dither ? 8 : 1;
+	sys->hysteresis = hysteresis;
+
+	for (unsigned y = 0; y < sys->threshold_rows; y++) {
+		for (unsigned x = 0; x < DISP_COLS; x++) {
+			// the pattern is centered on threshold and covers 1 to 253 for 127
+			int t = threshold + (dither ? ((bayer[y][x & 7] * 4) - 126) : 0);
+
+			sys->threshold_on[y][x] = Clamp(t - hysteresis);
+			sys->threshold_keep[y][x] = Clamp(t + hysteresis);
+		}
+	}
+}
+
 
 /**
  * This function initializes flipdot vout method.
@@ -66,9 +132,9 @@ static int Open(vlc_object_t *object)
 	vout_display_t *vd = (vout_display_t *)object;
 	vout_display_sys_t *sys = NULL;
 
-	if (!bcm2835_init()) {
-		msg_Err(vd, "cannot initialize bcm2835 library");
-		goto error;
+	if (!flipdot_init()) {
+		msg_Err(vd, "cannot initialize flipdot hardware");
+		return VLC_EGENERIC;
 	}
 
 	/* Allocate structure */
@@ -84,9 +150,25 @@ static int Open(vlc_object_t *object)
 		goto error;
 	}
 
-	flipdot_init();
+	SetupThresholds(sys, var_InheritInteger(vd, "flipdot-threshold"),
+					var_InheritBool(vd, "flipdot-dither"),
+					var_InheritInteger(vd, "flipdot-hysteresis"));
+
 	flipdot_clear_to_1();
 
+	// hysteresis keeps dots of sys->frame, start from the cleared display
+	flipdot_get_frame(sys->frame);
+
+	// phase counters for examples/flipstat
+	if (!flipdot_phase_stats_shm(FLIPDOT_PHASE_SHM))
+		msg_Dbg(vd, "flipdot phase counters not shared");
+
+	// Display() only hands frames to the output thread
+	if (!flipdot_async_start()) {
+		msg_Err(vd, "cannot start flipdot output thread");
+		goto error;
+	}
+
 	vout_display_DeleteWindow(vd, NULL);
 
 	/* Fix format */
@@ -116,6 +198,8 @@ static int Open(vlc_object_t *object)
 	return VLC_SUCCESS;
 
 error:
+	flipdot_shutdown();
+
 	if (sys) {
 		if (sys->pool)
 			picture_pool_Delete(sys->pool);
@@ -137,6 +221,7 @@ static void Close(vlc_object_t *object)
 	vout_display_t *vd = (vout_display_t *)object;
 	vout_display_sys_t *sys = vd->sys;
 
+	flipdot_async_stop();
 	flipdot_shutdown();
 
 	if (sys->pool)
@@ -161,8 +246,54 @@ static picture_pool_t *Pool(vout_display_t *vd, unsigned count)
 	return sys->pool;
 }
 
-#define SETBIT(b,i) ((((uint8_t *)(b))[(i) >> 3]) |= (1 << ((i) & 7)))
-#define CLEARBIT(b,i) ((((uint8_t *)(b))[(i) >> 3]) &=~ (1 << ((i) & 7)))
+/**
+ * Pack n luma bytes into LSB first bits, 1 for pixels <= their threshold
+ */
+static void PackRow(uint8_t *dst, const uint8_t *src, const uint8_t *threshold, unsigned n)
+{
+#if defined(__SSE2__)
+	// min(v, t) == v for v <= t, movemask packs the lanes LSB first
+	for (; n >= 16; n -= 16, src += 16, threshold += 16, dst += 2) {
+		__m128i v = _mm_loadu_si128((const __m128i *)src);
+		__m128i t = _mm_loadu_si128((const __m128i *)threshold);
+		unsigned bits = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(v, t), v));
+
+		dst[0] = bits;
+		dst[1] = bits >> 8;
+	}
+#elif defined(__ARM_NEON)
+	static const uint8_t weights[16] = {
+		1, 2, 4, 8, 16, 32, 64, 128,
+		1, 2, 4, 8, 16, 32, 64, 128
+	};
+	const uint8x16_t w = vld1q_u8(weights);
+
+	// weight the compare masks by bit, three pairwise adds sum each half
+	for (; n >= 16; n -= 16, src += 16, threshold += 16, dst += 2) {
+		uint8x16_t v = vandq_u8(vcleq_u8(vld1q_u8(src), vld1q_u8(threshold)), w);
+		uint8x8_t bits = vpadd_u8(vget_low_u8(v), vget_high_u8(v));
+
+		bits = vpadd_u8(bits, bits);
+		bits = vpadd_u8(bits, bits);
+
+		dst[0] = vget_lane_u8(bits, 0);
+		dst[1] = vget_lane_u8(bits, 1);
+	}
+#endif
+
+	while (n > 0) {
+		unsigned count = (n < 8) ? n : 8;
+		uint8_t bits = 0;
+
+		for (unsigned i = 0; i < count; i++)
+			bits |= (src[i] <= threshold[i]) << i;
+
+		*dst++ = bits;
+		src += count;
+		threshold += count;
+		n -= count;
+	}
+}
 
 /**
  * Prepare a picture for display
@@ -170,39 +301,104 @@ static picture_pool_t *Pool(vout_display_t *vd, unsigned count)
 static void Prepare(vout_display_t *vd, picture_t *picture, subpicture_t *subpicture)
 {
 	vout_display_sys_t *sys = vd->sys;
-//	int64_t threshold = var_InheritInteger(vd, "threshold");
-	uint8_t threshold = 127;
-
-	memset(sys->frame, 0x00, sizeof(*(sys->frame)));
-
-	// TODO: dithering
+	const plane_t *plane = &picture->p[0];
+	unsigned flips = 0;
+
+	// GREY has one byte per pixel
+	unsigned cols = plane->i_visible_pitch / plane->i_pixel_pitch;
+	unsigned rows = plane->i_visible_lines;
+
+	if (cols > DISP_COLS)
+		cols = DISP_COLS;
+	if (rows > DISP_ROWS)
+		rows = DISP_ROWS;
+
+	// sys->frame still holds the previous frame, dots only flip when the
+	// luma crosses the threshold by more than the hysteresis, so noise and
+	// the dither pattern don't make them shimmer
+	for (unsigned y = 0; y < DISP_ROWS; y++) {
+		uint8_t on[REGISTER_COL_BYTE_COUNT] = { 0 };
+		uint8_t keep_buf[REGISTER_COL_BYTE_COUNT] = { 0 };
+		uint8_t *keep = sys->hysteresis ? keep_buf : on;
+		uint8_t *dst = *sys->frame + (y * REGISTER_COL_BYTE_COUNT);
+
+		// pack every module row into its own frame bytes, the gap bits stay 0
+		if (y < rows) {
+			const uint8_t *src = plane->p_pixels + ((y + vd->source.i_y_offset) * plane->i_pitch) +
+									(vd->source.i_x_offset * plane->i_pixel_pitch);
+			const uint8_t *threshold_on = sys->threshold_on[y % sys->threshold_rows];
+			const uint8_t *threshold_keep = sys->threshold_keep[y % sys->threshold_rows];
+			unsigned m = 0;
+
+			for (unsigned x = 0; x < cols; x += MODULE_COLS) {
+				unsigned n = (cols - x < MODULE_COLS) ? (cols - x) : MODULE_COLS;
+
+				PackRow(on + m, src + x, threshold_on + x, n);
+				if (sys->hysteresis)
+					PackRow(keep + m, src + x, threshold_keep + x, n);
+				m += MODULE_REGISTER_BYTE_COUNT;
+			}
+		}
 
-	// another slow bit copy
-	for (unsigned long y = 0; y < picture->p->i_visible_lines; y++) {
-		for (unsigned long x = 0; x < picture->p->i_visible_pitch; x++) {
-			unsigned long pixelidx = ((y + vd->source.i_y_offset) * picture->p->i_pitch) +
-										((x + vd->source.i_x_offset) * picture->p->i_pixel_pitch);
+		for (unsigned i = 0; i < REGISTER_COL_BYTE_COUNT; i++) {
+			uint8_t dots = on[i] | (dst[i] & keep[i]);
 
-			uint8_t pixel_value = *(picture->p->p_pixels + pixelidx);
-			uint8_t pixel = 0;
-			if (pixel_value <= threshold && y < DISP_ROWS && x < DISP_COLS) {
-				SETBIT(sys->frame, (y * REGISTER_COLS) + x + ((x / MODULE_COLS) * COL_GAP));
-				pixel = 1;
-			}
-//printf("x = %ld, y = %ld, pixelidx = %ld, pixel_value = %d, pixel = %d\n", x, y, pixelidx, pixel_value, pixel);
+			flips += __builtin_popcount(dots ^ dst[i]);
+			dst[i] = dots;
 		}
 	}
+
+	sys->flips += flips;
+	if (flips > sys->flips_max)
+		sys->flips_max = flips;
 	VLC_UNUSED(subpicture);
 }
 
+/**
+ * Log flips per frame and frames the display could not keep up with
+ */
+static void Report(vout_display_t *vd)
+{
+	vout_display_sys_t *sys = vd->sys;
+	struct flipdot_async_stats stats;
+	uint32_t dropped;
+
+	flipdot_async_get_stats(&stats);
+	dropped = stats.dropped - sys->dropped;
+
+	msg_Dbg(vd, "%lu flips/frame average, %u max, %u late, %u dropped",
+			sys->flips / REPORT_FRAMES, sys->flips_max, sys->late, dropped);
+
+	if (dropped)
+		msg_Warn(vd, "display too slow, dropped %u of %u frames", dropped, REPORT_FRAMES);
+
+	sys->frames = 0;
+	sys->flips = 0;
+	sys->flips_max = 0;
+	sys->late = 0;
+	sys->dropped = stats.dropped;
+}
+
 /**
  * Display a picture
  */
 static void Display(vout_display_t *vd, picture_t *picture, subpicture_t *subpicture)
-{   
+{
+	vout_display_sys_t *sys = vd->sys;
+	struct flipdot_async_stats stats;
+
 //	assert(!picture_IsReferenced(picture));
 
-	flipdot_update_frame(vd->sys->frame);
+	// the frame is late if the output thread is still flipping the previous
+	// one, a frame still waiting for the thread is replaced and dropped
+	flipdot_async_get_stats(&stats);
+	if (stats.last_displayed != stats.submitted)
+		sys->late++;
+
+	flipdot_async_submit_frame(*sys->frame);
+
+	if (++sys->frames == REPORT_FRAMES)
+		Report(vd);
 
 	if (vd->cfg->display.width != DISP_COLS ||
 		vd->cfg->display.height != DISP_ROWS)